@@ -0,0 +1,28 @@
+#version 330 core
+
+// Persistence pass: the new map from client-ethernet-scalable.fs is blended
+// into a history that fades by 'decay' per frame, an exponential moving
+// average of the map. With peakHold the faded history and the new map are
+// combined by their maximum instead, which keeps a short burst on screen for
+// the whole fade time. The lag rows along the bottom (below stripTop) are
+// passed through, so they always show the latest rows.
+
+out vec4 FragColor;
+in vec3 ourColor;
+in vec2 TexCoord;
+
+uniform sampler2D currentmap;
+uniform sampler2D history;
+uniform float decay = 0.9;
+uniform bool peakHold = false;
+uniform float stripTop = 0.;
+
+void main()
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec4 current = texelFetch(currentmap, p, 0);
+    vec4 past = texelFetch(history, p, 0);
+    if (gl_FragCoord.y < stripTop) FragColor = current;
+    else if (peakHold) FragColor = max(current, decay * past);
+    else FragColor = mix(current, past, decay);
+}
@@ -0,0 +1,109 @@
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include "glad.h"
+
+#include "shader_s.h"
+
+#include <iostream>
+
+// Temporal persistence of the map on the GPU. Two history textures at the
+// render size are ping-ponged: each frame accumulate.fs reads the new map
+// and last frame's history and writes their blend (or, for peak hold, the
+// maximum of the new map and the faded history) into the other one, which
+// is then what gets shown. That is one extra full-screen pass and nothing is
+// read back to the CPU.
+//
+// The pass samples on texture units 4 and 5, which nothing else uses.
+
+#define ACCUMULATOR_TEXTURE_UNIT 4
+
+class MapAccumulator
+{
+public:
+    int width, height;
+    Shader shader;
+
+    MapAccumulator(const char *vertexPath, const char *fragmentPath)
+        : width(0), height(0), shader(vertexPath, fragmentPath), current(0)
+    {
+        decayloc = glGetUniformLocation(shader.ID, "decay");
+        peakholdloc = glGetUniformLocation(shader.ID, "peakHold");
+        striploc = glGetUniformLocation(shader.ID, "stripTop");
+        shader.use();
+        shader.setInt("currentmap", ACCUMULATOR_TEXTURE_UNIT);
+        shader.setInt("history", ACCUMULATOR_TEXTURE_UNIT + 1);
+        glGenFramebuffers(2, fbos);
+        glGenTextures(2, textures);
+    }
+    // match the render size; a new size starts from an empty history
+    // ------------------------------------------------------------------------
+    void resize(int w, int h)
+    {
+        if (w == width && h == height) return;
+        width = w;
+        height = h;
+        for (int i = 0; i < 2; i++) {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cout << "Accumulation framebuffer is not complete" << std::endl;
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        clear();
+    }
+    // forget the history
+    // ------------------------------------------------------------------------
+    void clear()
+    {
+        for (int i = 0; i < 2; i++) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    // fold the map in 'source' (render size) into the history, fading the
+    // old history by 'decay'; rows below stripTop (render pixels) are taken
+    // from 'source' as they are. Returns the framebuffer holding the result
+    // and leaves it bound
+    // ------------------------------------------------------------------------
+    unsigned int accumulate(unsigned int source, float decay, bool peakHold, float stripTop, unsigned int vao)
+    {
+        int next = 1 - current;
+        glActiveTexture(GL_TEXTURE0 + ACCUMULATOR_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glActiveTexture(GL_TEXTURE0 + ACCUMULATOR_TEXTURE_UNIT + 1);
+        glBindTexture(GL_TEXTURE_2D, textures[current]);
+        glActiveTexture(GL_TEXTURE0);
+
+        shader.use();
+        glUniform1f(decayloc, decay);
+        glUniform1i(peakholdloc, peakHold);
+        glUniform1f(striploc, stripTop);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbos[next]);
+        glViewport(0, 0, width, height);
+        glBindVertexArray(vao);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        current = next;
+        return fbos[current];
+    }
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        glDeleteFramebuffers(2, fbos);
+        glDeleteTextures(2, textures);
+    }
+
+private:
+    unsigned int fbos[2], textures[2];
+    int current;    // index of the latest history
+    int decayloc, peakholdloc, striploc;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef ARRAY_GEOMETRY_H
+#define ARRAY_GEOMETRY_H
+
+#include <cmath>
+
+// Shared description of the microphone array: mic positions, the baseline
+// pair table and the per-baseline lag offsets. The delay model here is the
+// same one the fragment shader uses, so anything computed on the CPU lines up
+// with what is drawn on screen.
+
+#ifndef NUMLAGS
+#define NUMLAGS 256
+#endif
+
+#define MAXMICS 64
+#define MAXBASELINES (MAXMICS * (MAXMICS - 1) / 2)
+
+const float SOUNDSPEED = 343.;
+const float SAMPLERATE = 46875.;
+
+struct ArrayGeometry
+{
+    int numMics;
+    int numBaselines;
+    float skyRadius;
+    float sampleRate;
+    float micpos[MAXMICS][3];
+    // Baseline b correlates mic baselineMics[b][0] with mic baselineMics[b][1],
+    // in the same order as the FPGA sends them: 1-2, 1-3, ..., 1-N, 2-3, ...
+    int baselineMics[MAXBASELINES][2];
+    float lagoffsets[MAXBASELINES];
+
+    ArrayGeometry() : numMics(0), numBaselines(0), skyRadius(1.), sampleRate(SAMPLERATE) {}
+
+    // build the baseline pair table for n mics
+    // ------------------------------------------------------------------------
+    void setNumMics(int n)
+    {
+        numMics = n;
+        numBaselines = 0;
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                baselineMics[numBaselines][0] = i;
+                baselineMics[numBaselines][1] = j;
+                numBaselines++;
+            }
+        }
+    }
+    // lags per metre of path difference
+    // ------------------------------------------------------------------------
+    float lagsPerMeter() const
+    {
+        return sampleRate / SOUNDSPEED;
+    }
+    // geometric lag (in samples) of baseline b for a source at point p
+    // ------------------------------------------------------------------------
+    float lag(int b, const float p[3]) const
+    {
+        const float *m1 = micpos[baselineMics[b][0]];
+        const float *m2 = micpos[baselineMics[b][1]];
+        return lagsPerMeter() * (distance(p, m2) - distance(p, m1));
+    }
+    // largest lag (in samples) that baseline b can physically produce
+    // ------------------------------------------------------------------------
+    float maxLag(int b) const
+    {
+        return lagsPerMeter() * distance(micpos[baselineMics[b][0]], micpos[baselineMics[b][1]]);
+    }
+    // fractional index into a lag row that the shader ends up reading for
+    // baseline b at geometric lag 'lag' (texel j has its centre at j + 0.5)
+    // ------------------------------------------------------------------------
+    float lagIndex(int b, float lag) const
+    {
+        return lag + lagoffsets[b] - 0.5f;
+    }
+    // inverse of lagIndex: geometric lag belonging to a (fractional) lag bin
+    // ------------------------------------------------------------------------
+    float binLag(int b, float index) const
+    {
+        return index + 0.5f - lagoffsets[b];
+    }
+    // true if o has the same geometric lags: positions, dome radius and sample
+    // rate, ignoring the lag offsets
+    // ------------------------------------------------------------------------
+    bool sameLags(const ArrayGeometry &o) const
+    {
+        if (numMics != o.numMics || skyRadius != o.skyRadius || sampleRate != o.sampleRate) return false;
+        for (int i = 0; i < numMics; i++) {
+            for (int k = 0; k < 3; k++) if (micpos[i][k] != o.micpos[i][k]) return false;
+        }
+        return true;
+    }
+    // true if o describes the same array (positions, offsets, dome radius, sample rate)
+    // ------------------------------------------------------------------------
+    bool sameAs(const ArrayGeometry &o) const
+    {
+        if (!sameLags(o)) return false;
+        for (int b = 0; b < numBaselines; b++) if (lagoffsets[b] != o.lagoffsets[b]) return false;
+        return true;
+    }
+
+    static float distance(const float a[3], const float b[3])
+    {
+        float dx = a[0] - b[0];
+        float dy = a[1] - b[1];
+        float dz = a[2] - b[2];
+        return sqrtf(dx * dx + dy * dy + dz * dz);
+    }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef ARRAY_UNIFORMS_H
+#define ARRAY_UNIFORMS_H
+
+#include "glad.h"
+
+#include "array_geometry.h"
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+// Everything the shaders need to know about the array, kept in two std140
+// uniform buffers instead of one uniform per mic and per baseline:
+//
+//   ArrayBlock (binding 0): mic positions, the colour of every baseline and
+//     the baseline pair table (two pairs per ivec4). Changes when a mic moves.
+//   CalibrationBlock (binding 1): lag offset per baseline, in a vec4 each
+//     (std140 pads array elements to 16 bytes anyway). Changes on every
+//     calibration key press.
+//
+// The shaders are written against NUMMICS and NUMBASELINES; preamble() gives
+// the matching #defines, block declarations and baselinePair() helper, to be
+// inserted after their #version line. Both sides of the layout live here, so
+// the same binary runs any mic count the uniform block size allows.
+
+#define ARRAY_BLOCK_BINDING 0
+#define CALIBRATION_BLOCK_BINDING 1
+
+class ArrayUniforms
+{
+public:
+    int numMics, numBaselines;
+
+    ArrayUniforms() : numMics(0), numBaselines(0), arrayBuffer(0), calibrationBuffer(0) {}
+
+    // GLSL declarations matching the buffer layout for this many mics
+    // ------------------------------------------------------------------------
+    static std::string preamble(int mics)
+    {
+        std::ostringstream s;
+        s << "#define NUMMICS " << mics << "\n"
+          << "#define NUMBASELINES " << mics * (mics - 1) / 2 << "\n"
+          << "layout(std140) uniform ArrayBlock {\n"
+          << "  vec4 micpos[NUMMICS];                 // xyz\n"
+          << "  vec4 palette[NUMBASELINES];           // rgba\n"
+          << "  ivec4 pairs[(NUMBASELINES + 1) / 2];  // baselines 2k (xy) and 2k + 1 (zw)\n"
+          << "};\n"
+          << "layout(std140) uniform CalibrationBlock {\n"
+          << "  vec4 calibration[NUMBASELINES];       // lag offset, unused, unused, unused\n"
+          << "};\n"
+          << "ivec2 baselinePair(int b) { ivec4 p = pairs[b / 2]; return (b % 2 == 0) ? p.xy : p.zw; }\n";
+        return s.str();
+    }
+    // create the buffers for this array; false if they exceed the uniform
+    // block size limit of this GL implementation
+    // ------------------------------------------------------------------------
+    bool init(const ArrayGeometry &geom)
+    {
+        numMics = geom.numMics;
+        numBaselines = geom.numBaselines;
+        GLint maxBlockSize = 0;
+        glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+        if ((GLint)arrayBlockSize() > maxBlockSize || (GLint)calibrationBlockSize() > maxBlockSize) {
+            std::cout << numMics << " mics need a " << arrayBlockSize() << " byte uniform block, this GL allows "
+                      << maxBlockSize << std::endl;
+            return false;
+        }
+
+        // pair table and palette are fixed for a given mic count
+        std::vector<float> block(arrayBlockSize() / sizeof(float), 0.f);
+        for (int b = 0; b < numBaselines; b++) {
+            float phase = b * 2. * M_PI / numBaselines;
+            float *c = &block[4 * (numMics + b)];
+            c[0] = (1. + cos(phase)) / 2.;
+            c[1] = (1. + cos(2. * M_PI / 3. + phase)) / 2.;
+            c[2] = (1. + cos(4. * M_PI / 3. + phase)) / 2.;
+            c[3] = 1.;
+            int *pair = (int *)&block[4 * (numMics + numBaselines) + 2 * b];
+            pair[0] = geom.baselineMics[b][0];
+            pair[1] = geom.baselineMics[b][1];
+        }
+        glGenBuffers(1, &arrayBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, arrayBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, arrayBlockSize(), &block[0], GL_DYNAMIC_DRAW);
+        glGenBuffers(1, &calibrationBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, calibrationBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, calibrationBlockSize(), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, ARRAY_BLOCK_BINDING, arrayBuffer);
+        glBindBufferBase(GL_UNIFORM_BUFFER, CALIBRATION_BLOCK_BINDING, calibrationBuffer);
+        setMicPositions(geom.micpos);
+        return true;
+    }
+    // point a program's blocks at our binding points
+    // ------------------------------------------------------------------------
+    void attach(unsigned int program) const
+    {
+        unsigned int index = glGetUniformBlockIndex(program, "ArrayBlock");
+        if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, ARRAY_BLOCK_BINDING);
+        index = glGetUniformBlockIndex(program, "CalibrationBlock");
+        if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, CALIBRATION_BLOCK_BINDING);
+    }
+    // ------------------------------------------------------------------------
+    void setMicPositions(const float (*micpos)[3])
+    {
+        std::vector<float> mics(4 * numMics, 0.f);
+        for (int i = 0; i < numMics; i++) {
+            for (int k = 0; k < 3; k++) mics[4 * i + k] = micpos[i][k];
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, arrayBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, mics.size() * sizeof(float), &mics[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    // ------------------------------------------------------------------------
+    void setCalibration(const float *lagoffsets)
+    {
+        std::vector<float> calibration(4 * numBaselines, 0.f);
+        for (int b = 0; b < numBaselines; b++) calibration[4 * b] = lagoffsets[b];
+        glBindBuffer(GL_UNIFORM_BUFFER, calibrationBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, calibration.size() * sizeof(float), &calibration[0]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        glDeleteBuffers(1, &arrayBuffer);
+        glDeleteBuffers(1, &calibrationBuffer);
+    }
+
+private:
+    unsigned int arrayBuffer, calibrationBuffer;
+
+    // std140: every array element takes a vec4 slot
+    size_t arrayBlockSize() const { return 16 * (numMics + numBaselines + (numBaselines + 1) / 2); }
+    size_t calibrationBlockSize() const { return 16 * numBaselines; }
+};
+
+#endif
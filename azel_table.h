@@ -0,0 +1,59 @@
+#ifndef AZEL_TABLE_H
+#define AZEL_TABLE_H
+
+#include "array_geometry.h"
+
+#include <vector>
+#include <cmath>
+
+// Direction-to-delay lookup table for the equirectangular azimuth/elevation
+// projection. Azimuth runs across the window from -180 to 180 degrees and
+// elevation up from the horizon to zenith, so the horizon, where most sources
+// are, gets as many pixels as any other elevation instead of being squeezed
+// into the rim of the orthographic dome.
+//
+// For every texel the table holds the geometric lag (in lags, without lag
+// offsets) of every baseline, for a source on the sky dome in that direction.
+// The shader reads it as a 2D texture array, one layer per baseline, with
+// linear filtering; the lags vary smoothly over the sky, so a modest table
+// is enough. It only depends on the mic positions and the dome radius.
+
+class AzElLagTable
+{
+public:
+    int width, height;
+    std::vector<float> data;   // [baseline][height][width]
+
+    AzElLagTable(int w = 512, int h = 128) : width(w), height(h), valid(false) {}
+
+    // direction of the centre of texel (i, j)
+    // ------------------------------------------------------------------------
+    float azimuth(int i) const { return ((i + 0.5f) / width * 2.f - 1.f) * M_PI; }
+    float elevation(int j) const { return (j + 0.5f) / height * M_PI / 2.; }
+    // rebuild the table if the array changed; returns true if it did
+    // ------------------------------------------------------------------------
+    bool update(const ArrayGeometry &geom)
+    {
+        if (valid && geom.sameLags(cached)) return false;  // lag offsets are applied in the shader
+        cached = geom;
+        data.resize((size_t)geom.numBaselines * width * height);
+        for (int j = 0; j < height; j++) {
+            float el = elevation(j);
+            for (int i = 0; i < width; i++) {
+                float az = azimuth(i);
+                float pos[3] = {geom.skyRadius * cosf(el) * cosf(az), geom.skyRadius * cosf(el) * sinf(az), geom.skyRadius * sinf(el)};
+                for (int b = 0; b < geom.numBaselines; b++) {
+                    data[((size_t)b * height + j) * width + i] = geom.lag(b, pos);
+                }
+            }
+        }
+        valid = true;
+        return true;
+    }
+
+private:
+    bool valid;
+    ArrayGeometry cached;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "glad.h"
+
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <ctime>
+#include <cstring>
+#include <utility>
+
+// Frame capture that never makes the render loop wait.
+//
+// capture() starts an asynchronous glReadPixels into the next buffer of a
+// ring of pixel pack buffers and puts a fence behind it; poll() picks up the
+// buffers whose fence has passed (without waiting), copies them out and hands
+// them to a pool of writer threads, which encode and write the files. If the
+// ring slot is still busy or the writers have fallen too far behind, the
+// frame is dropped and counted instead.
+//
+// Two kinds of frame:
+//   CAPTURE_WINDOW: what is on screen, RGB, written as PNG
+//   CAPTURE_MAP:    the map itself at render size, RGBA float, written raw
+//                   (rows bottom to top, as GL has them) with the size in the
+//                   file name
+
+#define CAPTURE_WINDOW 0
+#define CAPTURE_MAP 1
+
+class FrameCapture
+{
+public:
+    int kind;
+    bool active;
+
+    FrameCapture(int numBuffers = 4, int numWriters = 2, int queueLength = 8)
+        : kind(CAPTURE_WINDOW), active(false), slots(numBuffers), maxQueued(queueLength),
+          frame(0), written(0), dropped(0), reported(0), lastReport(0), stopping(false)
+    {
+        for (size_t i = 0; i < slots.size(); i++) {
+            glGenBuffers(1, &slots[i].pbo);
+            slots[i].size = 0;
+            slots[i].fence = 0;
+        }
+        for (int i = 0; i < numWriters; i++) writers.push_back(std::thread(&FrameCapture::writerLoop, this));
+    }
+    // ------------------------------------------------------------------------
+    void start(int captureKind)
+    {
+        kind = captureKind;
+        active = true;
+        frame = 0;
+        written = 0;
+        dropped = 0;
+        reported = 0;
+        std::ostringstream name;
+        name << "capture_" << time(NULL);
+        prefix = name.str();
+        std::cout << "Capturing " << (kind == CAPTURE_MAP ? "raw float maps" : "PNG frames") << " to "
+                  << prefix << "_*" << std::endl;
+    }
+    // stop capturing; frames already read back are still written
+    // ------------------------------------------------------------------------
+    void stop()
+    {
+        if (!active) return;
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].fence) glClientWaitSync(slots[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        poll();
+        active = false;
+        std::cout << "Capture stopped: " << frame - dropped << " of " << frame << " frames kept, "
+                  << dropped << " dropped" << std::endl;
+    }
+    // queue a readback of the given framebuffer (0 for the window), which
+    // has the given size
+    // ------------------------------------------------------------------------
+    void capture(unsigned int fbo, int width, int height)
+    {
+        if (!active) return;
+        Slot &s = slots[frame % slots.size()];
+        frame++;
+        if (s.fence) {
+            dropped++;
+            return;
+        }
+        s.width = width;
+        s.height = height;
+        s.number = frame - 1;
+        s.kind = kind;
+        size_t bytes = (size_t)width * height * (kind == CAPTURE_MAP ? 4 * sizeof(float) : 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+        if (bytes != s.size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+            s.size = bytes;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        if (kind == CAPTURE_MAP) glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, 0);
+        else glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    // hand finished readbacks to the writers; never waits for the GPU.
+    // Reports once a second while frames are being dropped
+    // ------------------------------------------------------------------------
+    void poll()
+    {
+        for (size_t i = 0; i < slots.size(); i++) {
+            Slot &s = slots[i];
+            if (!s.fence) continue;
+            if (glClientWaitSync(s.fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+            glDeleteSync(s.fence);
+            s.fence = 0;
+
+            bool full;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                full = (int)queue.size() >= maxQueued;
+            }
+            if (full) {
+                dropped++;
+                continue;
+            }
+            Job job;
+            job.kind = s.kind;
+            job.width = s.width;
+            job.height = s.height;
+            job.path = fileName(s);
+            job.data.resize(s.size);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+            void *p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, s.size, GL_MAP_READ_BIT);
+            if (p) memcpy(&job.data[0], p, s.size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                queue.push_back(std::move(job));
+            }
+            queueReady.notify_one();
+        }
+        if (active && dropped > reported) {
+            time_t now = time(NULL);
+            if (now != lastReport) {
+                std::cout << "Capture: " << written << " written, " << dropped << " dropped" << std::endl;
+                reported = dropped;
+                lastReport = now;
+            }
+        }
+    }
+    // stops the writers once the queue is written out
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (size_t i = 0; i < writers.size(); i++) writers[i].join();
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i].fence) glDeleteSync(slots[i].fence);
+            glDeleteBuffers(1, &slots[i].pbo);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        unsigned int pbo;
+        size_t size;
+        GLsync fence;
+        int width, height, number, kind;
+    };
+    struct Job
+    {
+        int kind, width, height;
+        std::string path;
+        std::vector<unsigned char> data;
+    };
+
+    std::vector<Slot> slots;
+    int maxQueued;
+    int frame;
+    std::atomic<int> written, dropped;
+    int reported;
+    time_t lastReport;
+    std::string prefix;
+
+    std::vector<std::thread> writers;
+    std::deque<Job> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    bool stopping;
+
+    std::string fileName(const Slot &s) const
+    {
+        std::ostringstream name;
+        name << prefix << "_" << std::setw(6) << std::setfill('0') << s.number;
+        if (s.kind == CAPTURE_MAP) name << "_" << s.width << "x" << s.height << ".f32";
+        else name << ".png";
+        return name.str();
+    }
+    // ------------------------------------------------------------------------
+    void writerLoop()
+    {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                while (queue.empty() && !stopping) queueReady.wait(lock);
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            bool ok;
+            if (job.kind == CAPTURE_MAP) {
+                std::ofstream f(job.path.c_str(), std::ios::binary);
+                f.write((const char *)&job.data[0], job.data.size());
+                ok = f.good();
+            } else {
+                ok = writePNG(job.path, job.width, job.height, job.data);
+            }
+            if (ok) written++;
+            else std::cout << "Could not write " << job.path << std::endl;
+        }
+    }
+    // 8-bit RGB PNG from bottom-up rows, fastest zlib level
+    // ------------------------------------------------------------------------
+    static bool writePNG(const std::string &path, int width, int height, const std::vector<unsigned char> &rgb)
+    {
+        size_t stride = 3 * (size_t)width;
+        std::vector<unsigned char> raw((stride + 1) * height);
+        for (int y = 0; y < height; y++) {
+            unsigned char *row = &raw[(stride + 1) * y];
+            row[0] = 0;     // no filter
+            memcpy(row + 1, &rgb[stride * (height - 1 - y)], stride);
+        }
+        uLongf packedSize = compressBound(raw.size());
+        std::vector<unsigned char> packed(packedSize);
+        if (compress2(&packed[0], &packedSize, &raw[0], raw.size(), Z_BEST_SPEED) != Z_OK) return false;
+
+        unsigned char header[13];
+        putBigEndian(header, width);
+        putBigEndian(header + 4, height);
+        header[8] = 8;      // bits per channel
+        header[9] = 2;      // RGB
+        header[10] = header[11] = header[12] = 0;
+
+        std::ofstream f(path.c_str(), std::ios::binary);
+        const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        f.write((const char *)signature, 8);
+        writeChunk(f, "IHDR", header, 13);
+        writeChunk(f, "IDAT", &packed[0], packedSize);
+        writeChunk(f, "IEND", NULL, 0);
+        return f.good();
+    }
+    static void writeChunk(std::ofstream &f, const char *type, const unsigned char *data, size_t length)
+    {
+        unsigned char word[4];
+        putBigEndian(word, length);
+        f.write((const char *)word, 4);
+        f.write(type, 4);
+        if (length) f.write((const char *)data, length);
+        uLong crc = crc32(0L, (const Bytef *)type, 4);
+        if (length) crc = crc32(crc, data, length);
+        putBigEndian(word, crc);
+        f.write((const char *)word, 4);
+    }
+    static void putBigEndian(unsigned char *p, unsigned long v)
+    {
+        p[0] = (v >> 24) & 255;
+        p[1] = (v >> 16) & 255;
+        p[2] = (v >> 8) & 255;
+        p[3] = v & 255;
+    }
+};
+
+#endif
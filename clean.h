@@ -0,0 +1,178 @@
+#ifndef CLEAN_H
+#define CLEAN_H
+
+#include "cpu_imager.h"
+#include "psf.h"
+
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Hogbom CLEAN on the CPU dirty map. With only 28 baselines the array's
+// response to a point source has strong sidelobes; CLEAN repeatedly finds the
+// brightest residual pixel, records a component there and subtracts a scaled,
+// shifted copy of the point-spread function (PSF). The restored map is the
+// component list convolved with a Gaussian beam the size of the PSF main lobe,
+// plus whatever residual is left.
+//
+// For a far-field source the lags are linear in the direction cosines (l, m),
+// so the PSF is (nearly) shift-invariant on the map grid: one PSF of twice the
+// map size, centred on a source at zenith, covers every shift. It comes from
+// the PSF cache, so it is only recomputed when the array changes.
+
+struct CleanComponent
+{
+    int ix, iy;     // map pixel
+    float l, m;     // direction cosines
+    float flux;
+};
+
+class Clean
+{
+public:
+    int maxIterations;
+    float gain;              // fraction of the peak removed per iteration
+    float threshold;         // absolute stop level, in map units
+    float relativeThreshold; // stop level as a fraction of the dirty map peak
+
+    std::vector<CleanComponent> components;
+    std::vector<float> residual;
+    std::vector<float> restored;
+    int iterations;
+    float beamSigma;         // clean beam sigma, in pixels
+
+    Clean() : maxIterations(100), gain(0.1f), threshold(0.f), relativeThreshold(0.05f),
+              iterations(0), beamSigma(1.f), psf(NULL) {}
+
+    // run CLEAN on a dirty map made by imager, with the PSF for the same
+    // geometry and baseline weights
+    // ------------------------------------------------------------------------
+    void run(const CPUImager &imager, const PSF &arrayPSF, const float *dirty)
+    {
+        int n = imager.size;
+        int npix = n * n;
+        psf = &arrayPSF;
+        beamSigma = psf->beamSigma;
+
+        residual.assign(dirty, dirty + npix);
+        components.clear();
+        iterations = 0;
+
+        int px, py;
+        float peak = findPeak(&residual[0], n, px, py);
+        float stop = threshold;
+        if (relativeThreshold * peak > stop) stop = relativeThreshold * peak;
+
+        for (; iterations < maxIterations; iterations++) {
+            if (iterations > 0) peak = findPeak(&residual[0], n, px, py);
+            if (peak <= stop) break;
+            float flux = gain * peak;
+            subtractPSF(&residual[0], n, px, py, flux);
+            addComponent(imager, px, py, flux);
+        }
+        restore(imager);
+    }
+
+private:
+    const PSF *psf;
+
+    // brightest pixel of the map; SSE2 max over each row, then the row's argmax
+    // ------------------------------------------------------------------------
+    static float findPeak(const float *map, int n, int &px, int &py)
+    {
+        float best = -1e30f;
+        int bestRow = 0;
+        for (int y = 0; y < n; y++) {
+            const float *row = map + (size_t)y * n;
+            float rowmax;
+            int x = 0;
+#if defined(__SSE2__)
+            __m128 vmax = _mm_set1_ps(-1e30f);
+            for (; x + 4 <= n; x += 4) vmax = _mm_max_ps(vmax, _mm_loadu_ps(row + x));
+            vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+            vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+            rowmax = _mm_cvtss_f32(vmax);
+#else
+            rowmax = -1e30f;
+#endif
+            for (; x < n; x++) if (row[x] > rowmax) rowmax = row[x];
+            if (rowmax > best) {
+                best = rowmax;
+                bestRow = y;
+            }
+        }
+        const float *row = map + (size_t)bestRow * n;
+        px = 0;
+        for (int x = 0; x < n; x++) {
+            if (row[x] == best) {
+                px = x;
+                break;
+            }
+        }
+        py = bestRow;
+        return best;
+    }
+    // residual -= flux * PSF centred on (px, py)
+    // ------------------------------------------------------------------------
+    void subtractPSF(float *map, int n, int px, int py, float flux)
+    {
+        for (int y = 0; y < n; y++) {
+            float *row = map + (size_t)y * n;
+            const float *prow = &psf->data[(size_t)(y - py + n) * psf->size + (n - px)];
+            int x = 0;
+#if defined(__SSE2__)
+            __m128 vf = _mm_set1_ps(flux);
+            for (; x + 4 <= n; x += 4) {
+                __m128 r = _mm_loadu_ps(row + x);
+                r = _mm_sub_ps(r, _mm_mul_ps(vf, _mm_loadu_ps(prow + x)));
+                _mm_storeu_ps(row + x, r);
+            }
+#endif
+            for (; x < n; x++) row[x] -= flux * prow[x];
+        }
+    }
+    // merge repeated hits on the same pixel into one component
+    // ------------------------------------------------------------------------
+    void addComponent(const CPUImager &imager, int px, int py, float flux)
+    {
+        for (size_t i = 0; i < components.size(); i++) {
+            if (components[i].ix == px && components[i].iy == py) {
+                components[i].flux += flux;
+                return;
+            }
+        }
+        CleanComponent c;
+        c.ix = px;
+        c.iy = py;
+        c.l = imager.pixelL(px);
+        c.m = imager.pixelM(py);
+        c.flux = flux;
+        components.push_back(c);
+    }
+    // restored = residual + components convolved with the clean beam
+    // ------------------------------------------------------------------------
+    void restore(const CPUImager &imager)
+    {
+        int n = imager.size;
+        restored = residual;
+        int r = (int)ceilf(3.f * beamSigma);
+        float inv2s2 = 1.f / (2.f * beamSigma * beamSigma);
+        for (size_t i = 0; i < components.size(); i++) {
+            const CleanComponent &c = components[i];
+            for (int y = c.iy - r; y <= c.iy + r; y++) {
+                if (y < 0 || y >= n) continue;
+                for (int x = c.ix - r; x <= c.ix + r; x++) {
+                    if (x < 0 || x >= n) continue;
+                    float d2 = (float)((x - c.ix) * (x - c.ix) + (y - c.iy) * (y - c.iy));
+                    restored[(size_t)y * n + x] += c.flux * expf(-d2 * inv2s2);
+                }
+            }
+        }
+        for (int p = 0; p < n * n; p++) if (!imager.onDome(p)) restored[p] = 0.;
+    }
+};
+
+#endif
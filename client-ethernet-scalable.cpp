@@ -14,6 +14,30 @@
 #include "stb_image.h"
 
 #include "shader_s.h"
+#include "array_geometry.h"
+#include "tdoa_solver.h"
+#include "cpu_imager.h"
+#include "psf.h"
+#include "clean.h"
+#include "nearfield.h"
+#include "azel_table.h"
+#include "lag_stream.h"
+#include "pixel_lags.h"
+#include "array_uniforms.h"
+#include "mic_overlay.h"
+#include "render_target.h"
+#include "accumulator.h"
+#include "capture.h"
+#include "frame_timer.h"
+#include "integrator.h"
+#include "fft.h"
+#include "upsample.h"
+#include "filter_bank.h"
+#include "lag_stats.h"
+#include "closure.h"
+#include "health.h"
+#include "normalize.h"
+#include "peaks.h"
 
 #include <iostream>
 #include <fstream>
@@ -29,6 +53,7 @@
 
 #include <math.h>
 #include <cmath>
+#include <chrono>
 
 #include "json.hpp"
 
@@ -44,18 +69,29 @@ void processInput(GLFWwindow *window);
 
 // Ugly global variables for key presses
 bool peakMode = true;
+// Peak mode shows up to numPeaks peaks per baseline, tracked from row to row
+int numPeaks = 2;
 int selectedBaseline = -1;
-char selectedMic = 0;
+int selectedMic = 0;
 float skyRadius = 1.0;
-float micpos1[3] = {-0.073, -0.065, 0.};
-float micpos2[3] = {0.073, -0.065, 0.};
-float micpos3[3] = {-0.038, 0.065, 0.};
-float micpos4[3] = {0.04, 0.065, 0.};
-float micpos5[3] = {0.118, 0.285, 0.};
-float micpos6[3] = {0.268, 0.285, 0.};
-float micpos7[3] = {0.026, -0.065, 0.};
-float micpos8[3] = {-0.026, -0.065, 0.};
-int m1loc, m2loc, m3loc, m4loc, m5loc, m6loc, m7loc, m8loc, smloc, sbloc, loloc, ascloc, ashloc, srloc;
+// Mic positions; the mic count is fixed at startup by the config file
+int numMics = 8;
+int numBaselines = 28;
+// Baseline packets carry their index in one header byte; 0xFF is not a
+// baseline and 0xFE marks the mic power packet. That caps the number of
+// baselines the client can take
+const int MAXPACKETBASELINES = 254;
+float micpos[MAXMICS][3] = {{-0.073, -0.065, 0.},
+                            {0.073, -0.065, 0.},
+                            {-0.038, 0.065, 0.},
+                            {0.04, 0.065, 0.},
+                            {0.118, 0.285, 0.},
+                            {0.268, 0.285, 0.},
+                            {0.026, -0.065, 0.},
+                            {-0.026, -0.065, 0.}};
+int sbloc, srloc, cmloc, prloc, vploc, plloc, rsloc, nbloc, bdloc, amloc;
+// Mic positions, baseline colours and pairs, and calibration, for the shaders
+ArrayUniforms arrayUniforms;
 bool jDown = false;
 bool eDown = false;
 bool zDown = false;
@@ -71,11 +107,92 @@ bool hDown = false;
 bool commaDown = false;
 bool periodDown = false;
 bool slashDown = false;
+bool kDown = false;
+bool qDown = false;
+bool fDown = false;
+bool aDown = false;
+bool dDown = false;
+bool iDown = false;
+bool leftBracketDown = false;
+bool rightBracketDown = false;
+bool rDown = false;
+bool oDown = false;
+bool yDown = false;
+bool wDown = false;
+bool uDown = false;
+bool sDown = false;
+bool semicolonDown = false;
+bool digitDown[10] = {false};
 bool ampSelected = false;
 bool autoScale = true;
-float lagoffsets[28] = {NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.,NUMLAGS/2.};
-float ampscales[28] = {1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1., 1.};
-float ampshifts[28] = {0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0.};
+// TDOA localisation stream: 0 = off, 1 = direction, 2 = position
+int tdoaMode = 0;
+TDOASolver tdoaSolver;
+// CPU-side maps, shown on the dome instead of the shader map
+#define CPUMAP_OFF 0
+#define CPUMAP_CLEAN 1
+#define CPUMAP_NEARFIELD 2
+int cpuMapMode = CPUMAP_OFF;
+// Sky projection: 0 = orthographic dome, 1 = equirectangular azimuth/elevation
+int projection = 0;
+// Imaging pass resolution: scaled down to stay within renderBudget ms, or
+// always at window resolution
+bool dynamicResolution = true;
+float renderBudget = 8.;
+// Map persistence: the shown map is blended into its history, which fades
+// with this time constant (seconds), or with peak hold is the maximum of the
+// new map and the faded history
+enum { PERSIST_OFF, PERSIST_AVERAGE, PERSIST_PEAK };
+int persistenceMode = PERSIST_OFF;
+float persistenceTime = 1.;
+// Frame capture: -1 = off, CAPTURE_WINDOW (PNG) or CAPTURE_MAP (raw float)
+int captureMode = -1;
+// Print CPU stage and GPU pass timing percentiles once a second
+bool timingReport = false;
+// Client-side integration windows (seconds); display and localisation each
+// use the latest dumps (-1) or one of the windows
+std::vector<float> integrationWindows = {0.05, 0.5, 5.};
+bool integrationChanged = false;
+int displayWindow = -1;
+int localizationWindow = -1;
+// GCC-PHAT: display, imaging and peak finding use the whitened lag rows;
+// bins are divided by their magnitude plus phatFloor times the mean
+bool gccPhat = false;
+float phatFloor = 0.1;
+// Lag rows are oversampled this many times (1, 4 or 8) for the lag texture
+// and peak finding
+int upsampleFactor = 1;
+// Filter bank: the lag texture holds one set of rows per band (edges in Hz),
+// imaged one band at a time or all bands combined
+#define BANDS_OFF -2
+#define BANDS_COMBINED -1
+std::vector<std::vector<float> > bandEdges = {{200., 800.}, {800., 2000.}, {2000., 5000.}, {5000., 12000.}};
+bool bandsChanged = true;
+int bandMode = BANDS_OFF;
+LagFilterBank filterBank;
+// Per-baseline lag statistics: rows are shown from their noise floor, and
+// baselines whose peak is below snrGood noise are left out of peak finding
+// and CPU imaging; statsRequested prints them once
+float snrGood = 6.;
+bool statsRequested = false;
+// Closure check: peak lags around every mic triangle should sum to zero;
+// baselines whose triangles fail by more than closureTolerance lags get
+// reported
+bool closureMode = false;
+float closureTolerance = 1.5;
+// Health monitor: baselines with zero, flat, stuck or out-of-range rows, and
+// the mics most of whose baselines are like that, are masked out of imaging
+bool autoMask = true;
+float varianceRatio = 100.;
+// Per-baseline calibration, set to defaults at startup
+float lagoffsets[MAXBASELINES];
+// Lag rows become correlation coefficients once the FPGA's mic power words
+// come in, so baselines need no amplitude calibration; what is left is one
+// contrast curve for the map, max((value - ampShift) * ampScale, -0.2)
+bool normalizeLags = true;
+LagNormalizer normalizer;
+float ampScale = 1.;
+float ampShift = 0.;
 
 bool gotConnection = false;
 char* commandLineArgs[3];
@@ -90,6 +207,31 @@ udp::endpoint local_endpoint;
 udp::socket sock(io_service);
 udp::endpoint sender_endpoint;
 
+// Collect the current mic positions, lag offsets and sky radius into one
+// geometry description for the CPU-side processing
+void fillGeometry(ArrayGeometry &geom) {
+  if (geom.numMics != numMics) geom.setNumMics(numMics);
+  for (int i = 0; i < numMics; i++) {
+    for (int k = 0; k < 3; k++) geom.micpos[i][k] = micpos[i][k];
+  }
+  for (int i = 0; i < numBaselines; i++) geom.lagoffsets[i] = lagoffsets[i];
+  geom.skyRadius = skyRadius;
+}
+
+// min (of the non-zero bins), max and peak bin of a lag row, leaving out
+// bins 0-4 like the packet decoder does
+void lagRowStats(const float *row, float startMin, float startMax, float &minval, float &maxval, int &peak) {
+  minval = startMin;
+  maxval = startMax;
+  for (int j = 5; j < NUMLAGS; j++) {
+    if (row[j] > maxval) {
+      maxval = row[j];
+      peak = j;
+    }
+    if (row[j] < minval && row[j] != 0) minval = row[j];
+  }
+}
+
 std::string uchar2hex(unsigned char inchar)
 {
   std::ostringstream oss (std::ostringstream::out);
@@ -105,131 +247,65 @@ void loadConfig(void) {
     json data = json::parse(f);
   
     skyRadius = data["config"]["skyradius"].get<float>();
-    micpos1[0] = data["config"]["positions"]["micpos1"]["x"].get<float>() * 0.0254;
-    micpos1[1] = data["config"]["positions"]["micpos1"]["y"].get<float>() * 0.0254;
-    micpos1[2] = data["config"]["positions"]["micpos1"]["z"].get<float>() * 0.0254;
-    micpos2[0] = data["config"]["positions"]["micpos2"]["x"].get<float>() * 0.0254;
-    micpos2[1] = data["config"]["positions"]["micpos2"]["y"].get<float>() * 0.0254;
-    micpos2[2] = data["config"]["positions"]["micpos2"]["z"].get<float>() * 0.0254;
-    micpos3[0] = data["config"]["positions"]["micpos3"]["x"].get<float>() * 0.0254;
-    micpos3[1] = data["config"]["positions"]["micpos3"]["y"].get<float>() * 0.0254;
-    micpos3[2] = data["config"]["positions"]["micpos3"]["z"].get<float>() * 0.0254;
-    micpos4[0] = data["config"]["positions"]["micpos4"]["x"].get<float>() * 0.0254;
-    micpos4[1] = data["config"]["positions"]["micpos4"]["y"].get<float>() * 0.0254;
-    micpos4[2] = data["config"]["positions"]["micpos4"]["z"].get<float>() * 0.0254;
-    micpos5[0] = data["config"]["positions"]["micpos5"]["x"].get<float>() * 0.0254;
-    micpos5[1] = data["config"]["positions"]["micpos5"]["y"].get<float>() * 0.0254;
-    micpos5[2] = data["config"]["positions"]["micpos5"]["z"].get<float>() * 0.0254;
-    micpos6[0] = data["config"]["positions"]["micpos6"]["x"].get<float>() * 0.0254;
-    micpos6[1] = data["config"]["positions"]["micpos6"]["y"].get<float>() * 0.0254;
-    micpos6[2] = data["config"]["positions"]["micpos6"]["z"].get<float>() * 0.0254;
-    micpos7[0] = data["config"]["positions"]["micpos7"]["x"].get<float>() * 0.0254;
-    micpos7[1] = data["config"]["positions"]["micpos7"]["y"].get<float>() * 0.0254;
-    micpos7[2] = data["config"]["positions"]["micpos7"]["z"].get<float>() * 0.0254;
-    micpos8[0] = data["config"]["positions"]["micpos8"]["x"].get<float>() * 0.0254;
-    micpos8[1] = data["config"]["positions"]["micpos8"]["y"].get<float>() * 0.0254;
-    micpos8[2] = data["config"]["positions"]["micpos8"]["z"].get<float>() * 0.0254;
-    lagoffsets[0]  = data["config"]["lagoffsets"]["lagoffset1"].get<float>();
-    lagoffsets[1]  = data["config"]["lagoffsets"]["lagoffset2"].get<float>();
-    lagoffsets[2]  = data["config"]["lagoffsets"]["lagoffset3"].get<float>();
-    lagoffsets[3]  = data["config"]["lagoffsets"]["lagoffset4"].get<float>();
-    lagoffsets[4]  = data["config"]["lagoffsets"]["lagoffset5"].get<float>();
-    lagoffsets[5]  = data["config"]["lagoffsets"]["lagoffset6"].get<float>();
-    lagoffsets[6]  = data["config"]["lagoffsets"]["lagoffset7"].get<float>();
-    lagoffsets[7]  = data["config"]["lagoffsets"]["lagoffset8"].get<float>();
-    lagoffsets[8]  = data["config"]["lagoffsets"]["lagoffset9"].get<float>();
-    lagoffsets[9]  = data["config"]["lagoffsets"]["lagoffset10"].get<float>();
-    lagoffsets[10] = data["config"]["lagoffsets"]["lagoffset11"].get<float>();
-    lagoffsets[11] = data["config"]["lagoffsets"]["lagoffset12"].get<float>();
-    lagoffsets[12] = data["config"]["lagoffsets"]["lagoffset13"].get<float>();
-    lagoffsets[13] = data["config"]["lagoffsets"]["lagoffset14"].get<float>();
-    lagoffsets[14] = data["config"]["lagoffsets"]["lagoffset15"].get<float>();
-    lagoffsets[15] = data["config"]["lagoffsets"]["lagoffset16"].get<float>();
-    lagoffsets[16] = data["config"]["lagoffsets"]["lagoffset17"].get<float>();
-    lagoffsets[17] = data["config"]["lagoffsets"]["lagoffset18"].get<float>();
-    lagoffsets[18] = data["config"]["lagoffsets"]["lagoffset19"].get<float>();
-    lagoffsets[19] = data["config"]["lagoffsets"]["lagoffset20"].get<float>();
-    lagoffsets[20] = data["config"]["lagoffsets"]["lagoffset21"].get<float>();
-    lagoffsets[21] = data["config"]["lagoffsets"]["lagoffset22"].get<float>();
-    lagoffsets[22] = data["config"]["lagoffsets"]["lagoffset23"].get<float>();
-    lagoffsets[23] = data["config"]["lagoffsets"]["lagoffset24"].get<float>();
-    lagoffsets[24] = data["config"]["lagoffsets"]["lagoffset25"].get<float>();
-    lagoffsets[25] = data["config"]["lagoffsets"]["lagoffset26"].get<float>();
-    lagoffsets[26] = data["config"]["lagoffsets"]["lagoffset27"].get<float>();
-    lagoffsets[27] = data["config"]["lagoffsets"]["lagoffset28"].get<float>();
-    ampscales[0]  = data["config"]["ampscales"]["ampscale1"].get<float>();
-    ampscales[1]  = data["config"]["ampscales"]["ampscale2"].get<float>();
-    ampscales[2]  = data["config"]["ampscales"]["ampscale3"].get<float>();
-    ampscales[3]  = data["config"]["ampscales"]["ampscale4"].get<float>();
-    ampscales[4]  = data["config"]["ampscales"]["ampscale5"].get<float>();
-    ampscales[5]  = data["config"]["ampscales"]["ampscale6"].get<float>();
-    ampscales[6]  = data["config"]["ampscales"]["ampscale7"].get<float>();
-    ampscales[7]  = data["config"]["ampscales"]["ampscale8"].get<float>();
-    ampscales[8]  = data["config"]["ampscales"]["ampscale9"].get<float>();
-    ampscales[9]  = data["config"]["ampscales"]["ampscale10"].get<float>();
-    ampscales[10] = data["config"]["ampscales"]["ampscale11"].get<float>();
-    ampscales[11] = data["config"]["ampscales"]["ampscale12"].get<float>();
-    ampscales[12] = data["config"]["ampscales"]["ampscale13"].get<float>();
-    ampscales[13] = data["config"]["ampscales"]["ampscale14"].get<float>();
-    ampscales[14] = data["config"]["ampscales"]["ampscale15"].get<float>();
-    ampscales[15] = data["config"]["ampscales"]["ampscale16"].get<float>();
-    ampscales[16] = data["config"]["ampscales"]["ampscale17"].get<float>();
-    ampscales[17] = data["config"]["ampscales"]["ampscale18"].get<float>();
-    ampscales[18] = data["config"]["ampscales"]["ampscale19"].get<float>();
-    ampscales[19] = data["config"]["ampscales"]["ampscale20"].get<float>();
-    ampscales[20] = data["config"]["ampscales"]["ampscale21"].get<float>();
-    ampscales[21] = data["config"]["ampscales"]["ampscale22"].get<float>();
-    ampscales[22] = data["config"]["ampscales"]["ampscale23"].get<float>();
-    ampscales[23] = data["config"]["ampscales"]["ampscale24"].get<float>();
-    ampscales[24] = data["config"]["ampscales"]["ampscale25"].get<float>();
-    ampscales[25] = data["config"]["ampscales"]["ampscale26"].get<float>();
-    ampscales[26] = data["config"]["ampscales"]["ampscale27"].get<float>();
-    ampscales[27] = data["config"]["ampscales"]["ampscale28"].get<float>();
-    ampshifts[0]  = data["config"]["ampoffsets"]["ampoffset1"].get<float>();
-    ampshifts[1]  = data["config"]["ampoffsets"]["ampoffset2"].get<float>();
-    ampshifts[2]  = data["config"]["ampoffsets"]["ampoffset3"].get<float>();
-    ampshifts[3]  = data["config"]["ampoffsets"]["ampoffset4"].get<float>();
-    ampshifts[4]  = data["config"]["ampoffsets"]["ampoffset5"].get<float>();
-    ampshifts[5]  = data["config"]["ampoffsets"]["ampoffset6"].get<float>();
-    ampshifts[6]  = data["config"]["ampoffsets"]["ampoffset7"].get<float>();
-    ampshifts[7]  = data["config"]["ampoffsets"]["ampoffset8"].get<float>();
-    ampshifts[8]  = data["config"]["ampoffsets"]["ampoffset9"].get<float>();
-    ampshifts[9]  = data["config"]["ampoffsets"]["ampoffset10"].get<float>();
-    ampshifts[10] = data["config"]["ampoffsets"]["ampoffset11"].get<float>();
-    ampshifts[11] = data["config"]["ampoffsets"]["ampoffset12"].get<float>();
-    ampshifts[12] = data["config"]["ampoffsets"]["ampoffset13"].get<float>();
-    ampshifts[13] = data["config"]["ampoffsets"]["ampoffset14"].get<float>();
-    ampshifts[14] = data["config"]["ampoffsets"]["ampoffset15"].get<float>();
-    ampshifts[15] = data["config"]["ampoffsets"]["ampoffset16"].get<float>();
-    ampshifts[16] = data["config"]["ampoffsets"]["ampoffset17"].get<float>();
-    ampshifts[17] = data["config"]["ampoffsets"]["ampoffset18"].get<float>();
-    ampshifts[18] = data["config"]["ampoffsets"]["ampoffset19"].get<float>();
-    ampshifts[19] = data["config"]["ampoffsets"]["ampoffset20"].get<float>();
-    ampshifts[20] = data["config"]["ampoffsets"]["ampoffset21"].get<float>();
-    ampshifts[21] = data["config"]["ampoffsets"]["ampoffset22"].get<float>();
-    ampshifts[22] = data["config"]["ampoffsets"]["ampoffset23"].get<float>();
-    ampshifts[23] = data["config"]["ampoffsets"]["ampoffset24"].get<float>();
-    ampshifts[24] = data["config"]["ampoffsets"]["ampoffset25"].get<float>();
-    ampshifts[25] = data["config"]["ampoffsets"]["ampoffset26"].get<float>();
-    ampshifts[26] = data["config"]["ampoffsets"]["ampoffset27"].get<float>();
-    ampshifts[27] = data["config"]["ampoffsets"]["ampoffset28"].get<float>();
+    if (data["config"].count("renderbudget")) renderBudget = data["config"]["renderbudget"].get<float>();
+    if (data["config"].count("persistence")) persistenceTime = data["config"]["persistence"].get<float>();
+    if (data["config"].count("phatfloor")) phatFloor = data["config"]["phatfloor"].get<float>();
+    if (data["config"].count("peaks")) numPeaks = data["config"]["peaks"].get<int>();
+    if (data["config"].count("normalize")) normalizeLags = data["config"]["normalize"].get<bool>();
+    if (data["config"].count("ampscale")) ampScale = data["config"]["ampscale"].get<float>();
+    if (data["config"].count("ampoffset")) ampShift = data["config"]["ampoffset"].get<float>();
+    if (data["config"].count("automask")) autoMask = data["config"]["automask"].get<bool>();
+    if (data["config"].count("varianceratio")) varianceRatio = data["config"]["varianceratio"].get<float>();
+    if (data["config"].count("closuretolerance")) closureTolerance = data["config"]["closuretolerance"].get<float>();
+    if (data["config"].count("snrgood")) snrGood = data["config"]["snrgood"].get<float>();
+    if (data["config"].count("upsample")) upsampleFactor = data["config"]["upsample"].get<int>();
+    if (data["config"].count("bands")) {
+      bandEdges = data["config"]["bands"].get<std::vector<std::vector<float> > >();
+      bandsChanged = true;
+    }
+    if (data["config"].count("integration")) {
+      std::vector<float> windows = data["config"]["integration"].get<std::vector<float> >();
+      if (!windows.empty() && windows != integrationWindows) {
+        integrationWindows = windows;
+        integrationChanged = true;
+      }
+    }
+    int configMics = 0;
+    while (data["config"]["positions"].count("micpos" + std::to_string(configMics + 1))) configMics++;
+    if (configMics != numMics) {
+      std::cout << "Config file has " << configMics << " mic positions, but this session runs " << numMics
+                << " mics; restart to change the mic count" << std::endl;
+    }
+    for (int i = 0; i < numMics && i < configMics; i++) {
+      json &pos = data["config"]["positions"]["micpos" + std::to_string(i + 1)];
+      micpos[i][0] = pos["x"].get<float>() * 0.0254;
+      micpos[i][1] = pos["y"].get<float>() * 0.0254;
+      micpos[i][2] = pos["z"].get<float>() * 0.0254;
+    }
+    for (int i = 0; i < numBaselines; i++) {
+      lagoffsets[i] = data["config"]["lagoffsets"]["lagoffset" + std::to_string(i + 1)].get<float>();
+    }
     glUniform1f(srloc, skyRadius);
-    glUniform3f(m1loc, micpos1[0], micpos1[1], micpos1[2]);
-    glUniform3f(m2loc, micpos2[0], micpos2[1], micpos2[2]);
-    glUniform3f(m3loc, micpos3[0], micpos3[1], micpos3[2]);
-    glUniform3f(m4loc, micpos4[0], micpos4[1], micpos4[2]);
-    glUniform3f(m5loc, micpos5[0], micpos5[1], micpos5[2]);
-    glUniform3f(m6loc, micpos6[0], micpos6[1], micpos6[2]);
-    glUniform3f(m7loc, micpos7[0], micpos7[1], micpos7[2]);
-    glUniform3f(m8loc, micpos8[0], micpos8[1], micpos8[2]);
-    glUniform1fv(loloc, 28, lagoffsets);
-    glUniform1fv(ascloc, 28, ampscales);
-    glUniform1fv(ashloc, 28, ampshifts);
+    arrayUniforms.setMicPositions(micpos);
+    arrayUniforms.setCalibration(lagoffsets);
   } catch (std::exception& e) {
     std::cout << "Could not load JSON config file!!" << std::endl;
   }
 }
 
+// Number of mic positions in the config file, or 0 if it cannot be read
+int configMicCount(void) {
+  try {
+    std::ifstream f("config.json");
+    json data = json::parse(f);
+    int n = 0;
+    while (data["config"]["positions"].count("micpos" + std::to_string(n + 1))) n++;
+    return n;
+  } catch (std::exception& e) {
+    return 0;
+  }
+}
+
 void setupEthernetConnection(char* argv[]) {
   try {
     std::cout << "Trying to set up UDP listener on IP " << argv[1] << " using port " << argv[2] << std::endl;
@@ -302,9 +378,46 @@ int main(int argc, char* argv[])
           return -1;
       }
   
-      // build and compile our shader program
+      // The mic count comes from the config file when it has a layout other
+      // than the built-in 8 mics; everything below is sized from it
+      int configMics = configMicCount();
+      bool configLayout = configMics >= 2 && configMics != numMics;
+      if (configLayout) {
+        if (configMics > MAXMICS) configMics = MAXMICS;
+        numMics = configMics;
+      }
+      numBaselines = numMics * (numMics - 1) / 2;
+      // Every baseline needs a packet index and a layer of the lag texture
+      GLint maxTextureLayers = 0;
+      glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxTextureLayers);
+      int maxBaselines = std::min(MAXPACKETBASELINES, (int)maxTextureLayers);
+      if (numBaselines > maxBaselines) {
+        int maxMics = 2;
+        while ((maxMics + 1) * maxMics / 2 <= maxBaselines) maxMics++;
+        std::cout << numMics << " mics give " << numBaselines << " baselines, but "
+                  << (maxBaselines == MAXPACKETBASELINES ? "the packet header can address" : "the lag texture can hold")
+                  << " at most " << maxBaselines << ": use at most " << maxMics << " mics" << std::endl;
+        glfwTerminate();
+        return -1;
+      }
+      for (int i = 0; i < MAXBASELINES; i++) {
+        lagoffsets[i] = NUMLAGS/2.;
+      }
+      std::cout << "Imaging with " << numMics << " mics, " << numBaselines << " baselines" << std::endl;
+
+      // Array geometry as seen by the CPU-side processing, refreshed every frame
+      ArrayGeometry geometry;
+      fillGeometry(geometry);
+      if (!arrayUniforms.init(geometry)) {
+        glfwTerminate();
+        return -1;
+      }
+
+      // build and compile our shader program, for this many mics
       // ------------------------------------
-      Shader ourShader("client-ethernet-scalable.vs", "client-ethernet-scalable.fs"); 
+      std::string shaderPreamble = ArrayUniforms::preamble(numMics);
+      Shader ourShader("client-ethernet-scalable.vs", "client-ethernet-scalable.fs", shaderPreamble);
+      arrayUniforms.attach(ourShader.ID);
   
       // set up vertex data (and buffer(s)) and configure vertex attributes
       float vertices[] = {
@@ -346,83 +459,205 @@ int main(int argc, char* argv[])
       // -------------------------
       unsigned int texture;
       glGenTextures(1, &texture);
-      glBindTexture(GL_TEXTURE_2D, texture); // all upcoming GL_TEXTURE_2D operations now have effect on this texture object
-      // set the texture wrapping parameters
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+      glBindTexture(GL_TEXTURE_1D_ARRAY, texture); // all upcoming GL_TEXTURE_1D_ARRAY operations now have effect on this texture object
+      // set the texture wrapping parameters (along the lags only; layers are picked exactly)
+      glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
       // set texture filtering parameters
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      // load image, create texture and generate mipmaps
+      glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_1D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      // allocate the lag texture once: a 1D texture array with one single-channel
+      // layer per baseline, so more mics only means more layers. After this only
+      // the rows that changed are streamed in
       
       //int width, height, nrChannels;
       //unsigned char *data = stbi_load("container.jpg", &width, &height, &nrChannels, 0);
   
-      float pixels[3 * NUMLAGS * 64];
-      for (int i = 0; i < 3 * NUMLAGS * 64; i++) {
-          //pixels[i] = 0;
-          pixels[i] = 0.;
-      }
-  
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, NUMLAGS, 64, 0, GL_RGB, GL_FLOAT, pixels);
-      glGenerateMipmap(GL_TEXTURE_2D);
+      std::vector<float> zerorows(NUMLAGS * numBaselines, 0.);
+      glTexImage2D(GL_TEXTURE_1D_ARRAY, 0, GL_R32F, NUMLAGS, numBaselines, 0, GL_RED, GL_FLOAT, &zerorows[0]);
+      // the upload buffer has room for upsampled rows of every band; the
+      // texture only gets wider when upsampling is switched on, and gets
+      // more layers with the filter bank
+      LagTextureStream lagStream(texture, GL_TEXTURE_1D_ARRAY, NUMLAGS * LagUpsampler::MAXFACTOR,
+                                 numBaselines * LagFilterBank::MAXBANDS);
+      lagStream.setShape(NUMLAGS, numBaselines);
+      std::cout << "Lag texture uploads through " << (lagStream.persistent ? "a persistently mapped" : "a per-frame mapped")
+                << " pixel buffer" << std::endl;
+      bool lagRowDirty[MAXBASELINES];
+      for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+      // the same per texture layer, for the band rows of each baseline
+      static bool layerDirty[LagFilterBank::MAXBANDS * MAXBASELINES];
+      bool lastPeakMode = peakMode, lastAutoScale = autoScale;
+      int lastSelectedBaseline = selectedBaseline;
   
       //stbi_image_free(data);
   
-      float lagvals[28][NUMLAGS];
-      for (int i = 0; i < 28; i++) {
+      static float lagvals[MAXBASELINES][NUMLAGS];
+      for (int i = 0; i < numBaselines; i++) {
         for (int j = 0; j < NUMLAGS; j++) {
           //lagvals[i][j] = 0;
           lagvals[i][j] = 0.;
         }
       }
   
-      float stdminvals[28] = {100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000., 100000000.};
-      // For use in peak tracking		         
-      float stdmaxvals[28] = {0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0., 0.};
-      float minvals[28];
-      float maxvals[28];
-      float ranges[28];
-      int maxbin[28] = {NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2, NUMLAGS/2};
+      // Noise floor, display range, peak and SNR of each baseline, updated
+      // with every dump; these replace fixed display ranges
+      LagStatistics rawStats;
+      rawStats.setBaselines(numBaselines);
+
+      // Integrated rows and their statistics, for display (0) and
+      // localisation (1)
+      LagIntegrator integrator;
+      integrator.setWindows(integrationWindows, numBaselines);
+      static float intvals[2][MAXBASELINES][NUMLAGS];
+      // integrated rows are averages already: no smoothing over rows
+      LagStatistics intStats[2] = {LagStatistics(1.), LagStatistics(1.)};
+      for (int v = 0; v < 2; v++) intStats[v].setBaselines(numBaselines);
+      int lastDisplayWindow = displayWindow;
+      int lastLocalizationWindow = localizationWindow;
+
+      // Cross-power spectra of the rows localisation works on, redone
+      // whenever those rows change. With GCC-PHAT the whitened rows for
+      // display (0) and localisation (1) come from them; the display rows
+      // get their own spectra when they are not the same rows
+      LagSpectra lagSpectra, displaySpectra;
+      float spectrumCentres[MAXBASELINES];
+      bool spectraDirty = true;
+      bool lastGccPhat = gccPhat;
+      static float phatvals[2][MAXBASELINES][NUMLAGS];
+      float phatmin[2][MAXBASELINES];
+      float phatmax[2][MAXBASELINES];
+      float phatranges[2][MAXBASELINES];
+      int phatbin[2][MAXBASELINES];
+
+      // Upsampled display and localisation rows, with their peak samples;
+      // the display shares the localisation rows when they are the same
+      LagUpsampler upsampler;
+      std::vector<float> upshown((size_t)LagFilterBank::MAXBANDS * numBaselines * NUMLAGS * LagUpsampler::MAXFACTOR);
+      std::vector<float> uploc((size_t)numBaselines * NUMLAGS * LagUpsampler::MAXFACTOR);
+      std::vector<int> upshownbin(LagFilterBank::MAXBANDS * numBaselines);
+      int uplocbin[MAXBASELINES];
+
+      // Display rows split into bands, band-major, with their statistics
+      int lastBandMode = bandMode;
+      std::vector<float> bandvals((size_t)LagFilterBank::MAXBANDS * numBaselines * NUMLAGS);
+      float (*bandrows)[NUMLAGS] = reinterpret_cast<float (*)[NUMLAGS]>(&bandvals[0]);
+      std::vector<float> bandmin(LagFilterBank::MAXBANDS * numBaselines);
+      std::vector<float> bandmax(LagFilterBank::MAXBANDS * numBaselines);
+      std::vector<float> bandranges(LagFilterBank::MAXBANDS * numBaselines);
+      std::vector<int> bandbin(LagFilterBank::MAXBANDS * numBaselines);
+
+      float peaklags[MAXBASELINES];
+      float peakweights[MAXBASELINES];
+      // TDOA solutions and CPU map summaries go to stdout at most once a second
+      double lastTDOAReport = 0., lastCPUMapReport = 0.;
+      ClosureCheck closureCheck;
+      LagPeakTracker peakTracker;
+      peakTracker.setBaselines(numBaselines);
+      std::vector<char> lastInconsistent;
+
+      // CPU imaging, CLEAN and near-field focusing; the map to show goes to texture unit 1
+      const int CPUMAPSIZE = 128;
+      CPUImager cpuImager(CPUMAPSIZE);
+      PSFCache psfCache;
+      Clean clean;
+      NearFieldImager nearField(CPUMAPSIZE, 32);
+
+      // Lag lookup table for the azimuth/elevation projection, on texture unit 2
+      AzElLagTable azelTable;
+      unsigned int lagtabletexture;
+      glGenTextures(1, &lagtabletexture);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, lagtabletexture);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      // Per-pixel lags of the sky dome, rendered offscreen, on texture unit 3
+      PixelLagTable pixelLags("client-ethernet-scalable.vs", "pixel-lags.fs", shaderPreamble);
+      arrayUniforms.attach(pixelLags.shader.ID);
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, pixelLags.texture);
+      glActiveTexture(GL_TEXTURE0);
+      // Mic markers and the selected baseline, drawn over the dome
+      MicOverlay micOverlay("mic-overlay.vs", "mic-overlay.fs");
+      // The imaging pass renders offscreen, at a resolution that keeps it
+      // within the frame time budget, and is upscaled into the window
+      RenderTarget renderTarget(renderBudget);
+      // Fading history of the map for the persistence mode
+      MapAccumulator accumulator("client-ethernet-scalable.vs", "accumulate.fs");
+      bool wasPersistent = false;
+      double lastFrameTime = glfwGetTime();
+      // Readback ring and writer threads for recording
+      FrameCapture frameCapture;
+      // Per-stage timings; the imaging pass also drives the dynamic resolution
+      FrameTimer frameTimer;
+      int receiveStage = frameTimer.addCpuStage("receive");
+      int lagRowStage = frameTimer.addCpuStage("lag rows");
+      int cpuMapStage = frameTimer.addCpuStage("CPU map");
+      int spectraStage = frameTimer.addCpuStage("spectra");
+      int upsampleStage = frameTimer.addCpuStage("upsample");
+      int closureStage = frameTimer.addCpuStage("closure");
+      int swapStage = frameTimer.addCpuStage("swap");
+      int uploadPass = frameTimer.addGpuPass("lag upload");
+      int imagingPass = frameTimer.addGpuPass("imaging");
+      int persistencePass = frameTimer.addGpuPass("persistence");
+      int displayPass = frameTimer.addGpuPass("upscale+overlay");
+      int capturePass = frameTimer.addGpuPass("capture");
+      double lastReportTime = glfwGetTime();
+      std::vector<float> dirtymap(CPUMAPSIZE * CPUMAPSIZE);
+      std::vector<float> cpumappixels(CPUMAPSIZE * CPUMAPSIZE);
+      static float imagerows[MAXBASELINES][NUMLAGS];
+      float imageweights[MAXBASELINES];
+      unsigned int cpumaptexture;
+      glGenTextures(1, &cpumaptexture);
+      glBindTexture(GL_TEXTURE_2D, cpumaptexture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, CPUMAPSIZE, CPUMAPSIZE, 0, GL_RED, GL_FLOAT, &cpumappixels[0]);
  
       // Get the locations of all our uniform variables in the shader,
       // so we can update them according to the user's input later
       srloc = glGetUniformLocation(ourShader.ID, "skyradius");
-      m1loc = glGetUniformLocation(ourShader.ID, "mic1pos");
-      m2loc = glGetUniformLocation(ourShader.ID, "mic2pos");
-      m3loc = glGetUniformLocation(ourShader.ID, "mic3pos");
-      m4loc = glGetUniformLocation(ourShader.ID, "mic4pos");
-      m5loc = glGetUniformLocation(ourShader.ID, "mic5pos");
-      m6loc = glGetUniformLocation(ourShader.ID, "mic6pos");
-      m7loc = glGetUniformLocation(ourShader.ID, "mic7pos");
-      m8loc = glGetUniformLocation(ourShader.ID, "mic8pos");
-      smloc = glGetUniformLocation(ourShader.ID, "selectedMic");
       sbloc = glGetUniformLocation(ourShader.ID, "selectedBaseline");
-      loloc = glGetUniformLocation(ourShader.ID, "lagoffsets");
-      ascloc = glGetUniformLocation(ourShader.ID, "ampscales");
-      ashloc = glGetUniformLocation(ourShader.ID, "ampshifts");
+      cmloc = glGetUniformLocation(ourShader.ID, "showCPUMap");
+      prloc = glGetUniformLocation(ourShader.ID, "projection");
+      vploc = glGetUniformLocation(ourShader.ID, "viewportSize");
+      plloc = glGetUniformLocation(ourShader.ID, "usePixelLags");
+      rsloc = glGetUniformLocation(ourShader.ID, "renderScale");
+      nbloc = glGetUniformLocation(ourShader.ID, "numBands");
+      bdloc = glGetUniformLocation(ourShader.ID, "band");
+      amloc = glGetUniformLocation(ourShader.ID, "amplitude");
 
       // Initialise the uniform variables properly with values we have here
       // (even though they also get initialised in the shader code itself)
-      glUniform3f(m1loc, micpos1[0], micpos1[1], micpos1[2]);
-      glUniform3f(m2loc, micpos2[0], micpos2[1], micpos2[2]);
-      glUniform3f(m3loc, micpos3[0], micpos3[1], micpos3[2]);
-      glUniform3f(m4loc, micpos4[0], micpos4[1], micpos4[2]);
-      glUniform3f(m5loc, micpos5[0], micpos5[1], micpos5[2]);
-      glUniform3f(m6loc, micpos6[0], micpos6[1], micpos6[2]);
-      glUniform3f(m7loc, micpos7[0], micpos7[1], micpos7[2]);
-      glUniform3f(m8loc, micpos8[0], micpos8[1], micpos8[2]);
-      glUniform1i(smloc, selectedMic);
+      ourShader.use();
+      ourShader.setInt("texture1", 0);
+      ourShader.setInt("cpumap", 1);
+      glUniform1i(cmloc, cpuMapMode != CPUMAP_OFF);
+      ourShader.setInt("lagtable", 2);
+      ourShader.setInt("pixellags", 3);
+      glUniform1i(prloc, projection);
+      int fbWidth, fbHeight;
+      glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+      glUniform2f(vploc, fbWidth, fbHeight);
       glUniform1i(sbloc, selectedBaseline);
-      glUniform1fv(loloc, 28, lagoffsets);
-      glUniform1fv(ascloc, 28, ampscales);
-      glUniform1fv(ashloc, 28, ampshifts);
+      arrayUniforms.setCalibration(lagoffsets);
       glUniform1f(srloc, skyRadius);
+      // there are no built-in positions for a different mic count
+      if (configLayout) loadConfig();
+      ArrayHealth health;
+      normalizer.setMics(numMics);
+      bool lastSaturated[MAXMICS] = {false};
+      fillGeometry(geometry);
+      health.setGeometry(geometry);
 
       // render loop
       // -----------
       while (!glfwWindowShouldClose(window))
       {
+        frameTimer.begin(receiveStage);
+        rawStats.snrGood = intStats[0].snrGood = intStats[1].snrGood = snrGood;
 	if (gotConnection) {
           bytes_available = sock.available();
           while (bytes_available > 0) {
@@ -437,10 +672,24 @@ int main(int argc, char* argv[])
 
 	    int baseline = -1;
 
+	    if (LagNormalizer::isPowerPacket((const unsigned char *)recv_buf.data())) {
+	      // Mic sums and powers of the dump whose baseline packets follow
+	      if (!normalizer.read((const unsigned char *)recv_buf.data(), len)) {
+	        std::cout << "Short mic power packet: " << len << " bytes" << std::endl;
+	      }
+	      for (int m = 0; m < numMics; m++) {
+	        if (normalizer.isSaturated(m) != lastSaturated[m]) {
+	          std::cout << "Mic " << m + 1 << " power " << (normalizer.isSaturated(m) ? "saturated" : "back in range") << std::endl;
+	          lastSaturated[m] = normalizer.isSaturated(m);
+	        }
+	      }
+	      continue;
+	    }
 	    if ((unsigned int)(uint8_t)recv_buf.data()[0] == (unsigned int)(uint8_t)recv_buf.data()[1] &&
 	        (unsigned int)(uint8_t)recv_buf.data()[0] == (unsigned int)(uint8_t)recv_buf.data()[2] &&
 	        (unsigned int)(uint8_t)recv_buf.data()[0] == (unsigned int)(uint8_t)recv_buf.data()[3] &&
-	        (unsigned int)(uint8_t)recv_buf.data()[0] != 255) {
+	        (unsigned int)(uint8_t)recv_buf.data()[0] != 255 &&
+	        (unsigned int)(uint8_t)recv_buf.data()[0] < (unsigned int)numBaselines) {
               baseline = (unsigned int)(uint8_t)recv_buf.data()[0];
 	      //std::cout << "B" << baseline << " ";
 	    } else {
@@ -451,51 +700,260 @@ int main(int argc, char* argv[])
 	    //std::cout << std::endl;
 
             if (baseline != -1) {
-	      minvals[baseline] = stdminvals[baseline];
-  	      maxvals[baseline] = stdmaxvals[baseline];
 	      if (selectedBaseline == -1 || selectedBaseline == baseline) { // FOR DEBUGGING
 	      //if (true) { // FOR DEBUGGING
   	        for (int j = 5; j < NUMLAGS; j++) {
-  	          lagvals[baseline][j] = 0.;
-  	          lagvals[baseline][j] = lagvals[baseline][j] + (float)((unsigned int)(uint8_t)recv_buf.data()[j * 4 + 3] << 24);
-  	          lagvals[baseline][j] = lagvals[baseline][j] + (float)((unsigned int)(uint8_t)recv_buf.data()[j * 4 + 2] << 16);
-  	          lagvals[baseline][j] = lagvals[baseline][j] + (float)((unsigned int)(uint8_t)recv_buf.data()[j * 4 + 1] << 8);
-  	          lagvals[baseline][j] = lagvals[baseline][j] + (float)((unsigned int)(uint8_t)recv_buf.data()[j * 4 + 0]);
+  	          // the lag accumulators are signed
+  	          lagvals[baseline][j] = (float)(int32_t)LagNormalizer::word((const unsigned char *)recv_buf.data(), j);
 	          //std::cout << lagvals[baseline][j] << " ";
-  	          if (lagvals[baseline][j] > maxvals[baseline]) {
-    	            maxvals[baseline] = lagvals[baseline][j];
-  	            maxbin[baseline] = j;
-  	          } 
-  	          if (lagvals[baseline][j] < minvals[baseline] && lagvals[baseline][j] != 0) minvals[baseline] = lagvals[baseline][j];
+  	        }
+  	        if (normalizeLags && normalizer.ready()) {
+  	          normalizer.normalize(lagvals[baseline], 5, NUMLAGS, geometry.baselineMics[baseline][0], geometry.baselineMics[baseline][1]);
   	        }
 	      } else {
   	        for (int j = 5; j < NUMLAGS; j++) {
   	          lagvals[baseline][j] = 0.;
-	          minvals[baseline] = 0;
-	          maxvals[baseline] = 100;
-	          maxbin[baseline] = 0;
   	        } 
 	      }
-	      //std::cout << minvals[baseline] << " " << maxvals[baseline] << std::endl;
-  	      ranges[baseline] = maxvals[baseline] - minvals[baseline];
-	      //if (maxvals[baseline] == 0) {
-	      //  std::cout << "Warning: baseline " << baseline << " has max of zero!" << std::endl;
-	      //}
+	      rawStats.update(baseline, lagvals[baseline]);
+	      if (selectedBaseline == -1 || selectedBaseline == baseline) {
+	        health.check(baseline, lagvals[baseline], rawStats.variance[baseline]);
+	      }
+	      lagRowDirty[baseline] = true;
+	      integrator.add(baseline, lagvals[baseline], glfwGetTime());
+	      spectraDirty = true;
 	    }
 	  }
+	  health.autoMask = autoMask;
+	  health.varianceRatio = varianceRatio;
+	  if (health.evaluate()) {
+	    health.report();
+	    for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+	  }
 	} else {
 	  // Full max lag variables with placeholder data
-	  for (int i = 0; i < 28; i++) {
-	    maxbin[i] = NUMLAGS/2;
-	    minvals[i] = -100000.;
-	    maxvals[i] = 100000.;
-	    ranges[i] = 200000.;
+	  for (int i = 0; i < numBaselines; i++) {
 	    for (int j = 0; j < NUMLAGS; j++) {
 	      lagvals[i][j] = 100000. * cos(10. * 3.141592654 * float(j - NUMLAGS/2) / float(NUMLAGS));
 	    }
+	    rawStats.update(i, lagvals[i]);
 	  }
+	  spectraDirty = true;
 	}
 
+        // Integrated rows for display and localisation, when a window is
+        // selected; they change as dumps come in and as old ones expire
+        if (integrationChanged) {
+          integrator.setWindows(integrationWindows, numBaselines);
+          if (displayWindow >= integrator.numWindows()) displayWindow = -1;
+          if (localizationWindow >= integrator.numWindows()) localizationWindow = -1;
+          integrationChanged = false;
+        }
+        if (displayWindow != lastDisplayWindow || localizationWindow != lastLocalizationWindow) {
+          for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+          if (displayWindow >= 0) integrator.touch(displayWindow);
+          if (localizationWindow >= 0) integrator.touch(localizationWindow);
+          lastDisplayWindow = displayWindow;
+          lastLocalizationWindow = localizationWindow;
+          spectraDirty = true;
+        }
+        bool integrating = gotConnection;
+        if (integrating) integrator.advance(glfwGetTime());
+        int views[2] = {displayWindow, localizationWindow};
+        for (int v = 0; v < 2; v++) {
+          // localisation on the display window shares its rows
+          if (!integrating || views[v] < 0 || (v == 1 && views[1] == views[0])) continue;
+          for (int i = 0; i < numBaselines; i++) {
+            if (!integrator.takeChanged(views[v], i)) continue;
+            if (!integrator.mean(views[v], i, intvals[v][i])) {
+              for (int j = 0; j < NUMLAGS; j++) intvals[v][i][j] = 0.;
+            }
+            intStats[v].update(i, intvals[v][i]);
+            if (v == 0) lagRowDirty[i] = true;
+            spectraDirty = true;
+          }
+        }
+        bool showIntegrated = integrating && displayWindow >= 0;
+        float (*shownvals)[NUMLAGS] = showIntegrated ? intvals[0] : lagvals;
+        LagStatistics &shownStats = showIntegrated ? intStats[0] : rawStats;
+        float *shownmin = &shownStats.low[0];
+        float *shownranges = &shownStats.span[0];
+        int *shownbin = &shownStats.peakBin[0];
+        int lv = (localizationWindow == displayWindow) ? 0 : 1;
+        bool locIntegrated = integrating && localizationWindow >= 0;
+        float (*locvals)[NUMLAGS] = locIntegrated ? intvals[lv] : lagvals;
+        LagStatistics &locStats = locIntegrated ? intStats[lv] : rawStats;
+        float *locmin = &locStats.low[0];
+        float *locranges = &locStats.span[0];
+        int *locbin = &locStats.peakBin[0];
+        // baselines with signal, or all of them while none has any
+        bool weighByQuality = locStats.numGood() > 0;
+
+        frameTimer.end(receiveStage);
+        fillGeometry(geometry);
+
+        // One spectrum frame per lag frame, with phases referenced to each
+        // baseline's zero lag
+        if (gccPhat != lastGccPhat || bandMode != lastBandMode || bandsChanged) {
+          if (bandsChanged) {
+            // a texture layer per band and baseline, within the GPU's limit
+            int maxBands = maxTextureLayers / numBaselines;
+            std::vector<std::vector<float> > edges = bandEdges;
+            if ((int)edges.size() > maxBands) {
+              std::cout << "Only " << maxBands << " of " << edges.size() << " bands fit the lag texture for "
+                        << numBaselines << " baselines" << std::endl;
+              edges.resize(maxBands);
+            }
+            filterBank.setBands(edges, SAMPLERATE);
+            if (bandMode >= filterBank.numBands()) bandMode = BANDS_COMBINED;
+            bandsChanged = false;
+          }
+          for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+          spectraDirty = true;
+          lastGccPhat = gccPhat;
+          lastBandMode = bandMode;
+        }
+        bool banding = bandMode != BANDS_OFF && filterBank.numBands() > 0;
+        int numBands = banding ? filterBank.numBands() : 1;
+        int numLayers = numBands * numBaselines;
+        bool shownSeparate = shownvals != locvals;
+        bool locChanged = spectraDirty;
+        bool bandsUpdated = false;
+        if (spectraDirty) {
+          frameTimer.begin(spectraStage);
+          for (int i = 0; i < numBaselines; i++) spectrumCentres[i] = geometry.lagoffsets[i] - 0.5;
+          lagSpectra.transform(locvals, numBaselines, spectrumCentres);
+          if (shownSeparate && (gccPhat || banding)) displaySpectra.transform(shownvals, numBaselines, spectrumCentres);
+          lagSpectra.phatFloor = phatFloor;
+          displaySpectra.phatFloor = phatFloor;
+          if (gccPhat) {
+            lagSpectra.whiten(phatvals[1]);
+            if (shownSeparate) displaySpectra.whiten(phatvals[0]);
+            for (int v = shownSeparate ? 0 : 1; v < 2; v++) {
+              for (int i = 0; i < numBaselines; i++) {
+                phatbin[v][i] = NUMLAGS/2;
+                lagRowStats(phatvals[v][i], 1e30, -1e30, phatmin[v][i], phatmax[v][i], phatbin[v][i]);
+                phatranges[v][i] = phatmax[v][i] - phatmin[v][i];
+                lagRowDirty[i] = true;
+              }
+            }
+          }
+          // the display rows of every band in one go, whitened too with GCC-PHAT
+          if (banding) {
+            filterBank.run(shownSeparate ? displaySpectra : lagSpectra, bandrows, gccPhat);
+            for (int l = 0; l < numLayers; l++) {
+              bandbin[l] = NUMLAGS/2;
+              lagRowStats(bandrows[l], 1e30, -1e30, bandmin[l], bandmax[l], bandbin[l]);
+              bandranges[l] = bandmax[l] - bandmin[l];
+            }
+            for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+            bandsUpdated = true;
+          }
+          frameTimer.end(spectraStage);
+          spectraDirty = false;
+        }
+        if (gccPhat) {
+          int sv = shownSeparate ? 0 : 1;
+          shownvals = phatvals[sv];
+          shownmin = phatmin[sv];
+          shownranges = phatranges[sv];
+          shownbin = phatbin[sv];
+          locvals = phatvals[1];
+          locmin = phatmin[1];
+          locranges = phatranges[1];
+          locbin = phatbin[1];
+        }
+
+        // Lag texture shape: upsampled row length, a layer per band and baseline
+        if (upsampleFactor != upsampler.factor || numLayers != lagStream.rows) {
+          upsampler.setFactor(upsampleFactor);
+          upsampleFactor = upsampler.factor;
+          std::vector<float> zeros((size_t)upsampler.length() * numLayers, 0.);
+          glBindTexture(GL_TEXTURE_1D_ARRAY, texture);
+          glTexImage2D(GL_TEXTURE_1D_ARRAY, 0, GL_R32F, upsampler.length(), numLayers, 0, GL_RED, GL_FLOAT, &zeros[0]);
+          lagStream.setShape(upsampler.length(), numLayers);
+          for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+          locChanged = true;
+          bandsUpdated = banding;
+        }
+
+        // Oversampled rows for the lag texture and for peak finding
+        bool upsampling = upsampler.factor > 1;
+        int upLength = upsampler.length();
+        bool shownShared = !banding && shownvals == locvals;
+        float *upshownrows = shownShared ? &uploc[0] : &upshown[0];
+        int *upshownpeaks = shownShared ? uplocbin : &upshownbin[0];
+        if (upsampling) {
+          frameTimer.begin(upsampleStage);
+          if (locChanged) {
+            upsampler.process(locvals, numBaselines, &uploc[0]);
+            for (int i = 0; i < numBaselines; i++) uplocbin[i] = upsampler.peak(&uploc[(size_t)i * upLength]);
+          }
+          bool shownChanged = false;
+          for (int i = 0; i < numBaselines; i++) shownChanged = shownChanged || lagRowDirty[i];
+          if (banding && bandsUpdated) {
+            upsampler.process(bandrows, numLayers, &upshown[0]);
+            for (int l = 0; l < numLayers; l++) upshownbin[l] = upsampler.peak(&upshown[(size_t)l * upLength]);
+          } else if (!banding && !shownShared && shownChanged) {
+            upsampler.process(shownvals, numBaselines, &upshown[0]);
+            for (int i = 0; i < numBaselines; i++) upshownbin[i] = upsampler.peak(&upshown[(size_t)i * upLength]);
+          }
+          frameTimer.end(upsampleStage);
+        }
+
+        // Peak lags of all baselines, for direct localisation and the
+        // closure check
+        if (tdoaMode != 0 || closureMode) {
+          std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+          for (int i = 0; i < numBaselines; i++) {
+            float bin;
+            if (upsampling) {
+              bin = upsampler.bin(TDOASolver::refinePeak(&uploc[(size_t)i * upLength], uplocbin[i], upsampler.firstSample(), upLength - 1));
+            } else {
+              bin = TDOASolver::refinePeak(locvals[i], locbin[i], 5, NUMLAGS - 1);
+            }
+            peaklags[i] = geometry.binLag(i, bin);
+            peakweights[i] = (selectedBaseline == -1 || selectedBaseline == i) && !health.masked[i] && (!weighByQuality || locStats.good[i]) ? 1. : 0.;
+          }
+          if (tdoaMode != 0) {
+            const TDOASolution &sol = tdoaSolver.solve(geometry, peaklags, peakweights);
+            std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+            if (sol.valid && glfwGetTime() - lastTDOAReport >= 1.) {
+              lastTDOAReport = glfwGetTime();
+              std::cout << "TDOA az " << std::fixed << std::setprecision(1) << sol.azimuth * 180. / M_PI
+                        << " el " << sol.elevation * 180. / M_PI
+                        << " pos " << std::setprecision(3) << sol.pos[0] << " " << sol.pos[1] << " " << sol.pos[2]
+                        << " rms " << std::setprecision(2) << sol.rms << " lags, " << sol.usedBaselines << " baselines, "
+                        << sol.iterations << " it, " << std::setprecision(1)
+                        << std::chrono::duration<double, std::micro>(t1 - t0).count() << " us" << std::defaultfloat << std::endl;
+            }
+          }
+        }
+
+        // Closure delays around all mic triangles; report when the set of
+        // inconsistent baselines changes
+        if (closureMode) {
+          frameTimer.begin(closureStage);
+          if (closureCheck.micCount() != geometry.numMics) closureCheck.setGeometry(geometry);
+          closureCheck.tolerance = closureTolerance;
+          closureCheck.evaluate(peaklags, peakweights);
+          frameTimer.end(closureStage);
+          if (closureCheck.inconsistent != lastInconsistent) {
+            std::cout << "Closure: " << closureCheck.numFailed << " of " << closureCheck.numTested << " triangles off by more than "
+                      << closureTolerance << " lags, rms " << closureCheck.rms << " lags";
+            int flagged = 0;
+            for (int i = 0; i < numBaselines; i++) {
+              if (!closureCheck.inconsistent[i]) continue;
+              std::cout << (flagged++ ? ", " : "; inconsistent baselines ") << i << " (mics " << geometry.baselineMics[i][0] + 1
+                        << "-" << geometry.baselineMics[i][1] + 1 << ")";
+            }
+            std::cout << std::endl;
+            lastInconsistent = closureCheck.inconsistent;
+          }
+        } else {
+          lastInconsistent.clear();
+        }
+
         // input
         // -----
         processInput(window);
@@ -506,68 +964,306 @@ int main(int argc, char* argv[])
         glClear(GL_COLOR_BUFFER_BIT);
   
         // bind Texture
-        glBindTexture(GL_TEXTURE_2D, texture);
+        glBindTexture(GL_TEXTURE_1D_ARRAY, texture);
   
   	// Texture updates here
-  	
-  	for (int i = 0; i < 28; i++) {
-  	  if (ranges[i] < 100000) ranges[i] = 100000;
-          for (int j = 5; j < NUMLAGS; j++) {
-            for (int k = 0; k < 2; k++) {
-  	      // baseline i, lag j.
-  	      // We use 2 pixelrows per baseline.
-              // Experiment to see if we can just track the peak
-  	      if (peakMode) {
-                //int pv = 255 * (lagvals[i][j] - minvals[i]) / (ranges[i]);
-  	        if (j == maxbin[i] && (i == selectedBaseline || selectedBaseline == -1)) {
-  	          //pixels[3 * 128 * 2 + i * 3 * 128 * 4 + k * 128 * 3 + j * 3] = (unsigned char)(255);
-  	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3] = 1.;
-  	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3 + 1] = 0.;
-  	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3 + 2] = 0.;
-  	        } else {
-  	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3] = 0.;
-  	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3 + 1] = 0.;
-  	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3 + 2] = 0.;
-  	        }
-              } else {
-  	        // Use normal, full lag functions here
-		if (selectedBaseline == -1 || i == selectedBaseline) {
-		  if (autoScale) {
-	            float pv = (lagvals[i][j] - minvals[i]) / (ranges[i]);
-  	            pv < 0. ? pv = 0. : pv = pv;
-  	            pv > 1. ? pv = 1. : pv = pv;
-  	            pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3] = pv;
-		  } else {
-  	            pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3] = lagvals[i][j];
-		  }
+  	// Rows only change when their baseline got a new packet, or when the
+  	// way they are drawn changed
+  	if (peakMode != lastPeakMode || autoScale != lastAutoScale || selectedBaseline != lastSelectedBaseline) {
+  	  for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = true;
+  	  lastPeakMode = peakMode;
+  	  lastAutoScale = autoScale;
+  	  lastSelectedBaseline = selectedBaseline;
+  	}
+        frameTimer.begin(lagRowStage);
+  	// Peak tracks of the broadband rows that changed, found on the
+  	// upsampled rows when there are any
+  	if (peakMode) {
+  	  peakTracker.numPeaks = numPeaks;
+  	  bool upsampledRows = upsampling && !banding;
+  	  for (int i = 0; i < numBaselines; i++) {
+  	    if (!lagRowDirty[i]) continue;
+  	    if (upsampledRows) {
+  	      peakTracker.update(i, upshownrows + (size_t)i * upLength, upsampler.firstSample(), upLength - 1,
+  	                         shownmin[i], shownranges[i], upsampler.factor);
+  	    } else {
+  	      peakTracker.update(i, shownvals[i], 5, NUMLAGS - 1, shownmin[i], shownranges[i]);
+  	    }
+  	  }
+  	}
+  	float *lagrows = lagStream.beginFrame();
+  	// one texture layer per band and baseline, band-major
+  	for (int l = 0; l < numLayers; l++) {
+  	  int i = l % numBaselines;
+  	  layerDirty[l] = lagRowDirty[i];
+  	  if (!lagRowDirty[i] || lagrows == NULL) continue;
+  	  // upsampled rows have upLength samples, of which the first
+  	  // upsampler.firstSample() are bins 0-4
+  	  float *row = lagrows + (size_t)l * upLength;
+  	  const float *src;
+  	  float rowmin, rowrange;
+  	  int peakbin;
+  	  if (banding) {
+  	    src = upsampling ? upshownrows + (size_t)l * upLength : bandrows[l];
+  	    rowmin = bandmin[l];
+  	    rowrange = bandranges[l];
+  	    peakbin = upsampling ? upshownpeaks[l] : bandbin[l];
+  	  } else {
+  	    src = upsampling ? upshownrows + (size_t)i * upLength : shownvals[i];
+  	    rowmin = shownmin[i];
+  	    rowrange = shownranges[i];
+  	    peakbin = upsampling ? upshownpeaks[i] : shownbin[i];
+  	  }
+  	  int first = upsampling ? upsampler.firstSample() : 5;
+  	  bool shown = (selectedBaseline == -1 || i == selectedBaseline) && !health.masked[i];
+  	  for (int j = 0; j < first; j++) row[j] = 0.;
+          for (int j = first; j < upLength; j++) {
+  	    // baseline i, lag j.
+            // Experiment to see if we can just track the peak
+  	    if (peakMode) {
+  	      // band layers show their highest peak, broadband rows their tracks
+  	      row[j] = (banding && j == peakbin && shown) ? 1. : 0.;
+            } else {
+  	      // Use normal, full lag functions here
+	      if (shown) {
+		if (autoScale) {
+	          float pv = (src[j] - rowmin) / rowrange;
+  	          pv < 0. ? pv = 0. : pv = pv;
+  	          pv > 1. ? pv = 1. : pv = pv;
+  	          row[j] = pv;
 		} else {
-	          pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3] = 0.;
+  	          row[j] = src[j];
 		}
-  	        pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3 + 1] = 0;
-  	        pixels[i * 3 * NUMLAGS * 2 + k * NUMLAGS * 3 + j * 3 + 2] = 0;
-  	      }
+	      } else {
+	        row[j] = 0.;
+	      }
+  	    }
+  	  }
+  	  if (peakMode && !banding && shown) {
+  	    for (int k = 0; k < LagPeakTracker::MAXPEAKS; k++) {
+  	      if (!peakTracker.confirmed(i, k)) continue;
+  	      int u = upsampling ? upsampler.sample(peakTracker.track(i, k).bin) : (int)floorf(peakTracker.track(i, k).bin + 0.5f);
+  	      if (u >= first && u < upLength) row[u] = 1.;
   	    }
   	  }
-	  //std::cout << std::endl;
         }
   
-  	// Upload the updated texture to the GPU
-  	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, NUMLAGS, 64, 0, GL_RGB, GL_FLOAT, pixels);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        frameTimer.end(lagRowStage);
+
+  	// Upload the rows that changed to the GPU
+  	if (lagrows != NULL) {
+  	  frameTimer.begin(uploadPass);
+  	  lagStream.endFrame(layerDirty);
+  	  frameTimer.end(uploadPass);
+  	  for (int i = 0; i < numBaselines; i++) lagRowDirty[i] = false;
+  	}
+
+        // Rebuild the azimuth/elevation lag table when the array has changed
+        if (projection == 1 && azelTable.update(geometry)) {
+          glActiveTexture(GL_TEXTURE2);
+          glBindTexture(GL_TEXTURE_2D_ARRAY, lagtabletexture);
+          glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, azelTable.width, azelTable.height, geometry.numBaselines, 0, GL_RED, GL_FLOAT, &azelTable.data[0]);
+          glActiveTexture(GL_TEXTURE0);
+        }
+
+        // CPU-side maps: CLEAN the dirty map, or focus over range slices
+        if (cpuMapMode != CPUMAP_OFF) {
+          frameTimer.begin(cpuMapStage);
+          std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+          for (int i = 0; i < numBaselines; i++) {
+            for (int j = 0; j < NUMLAGS; j++) {
+              float pv = (j < 5) ? 0. : (locvals[i][j] - locmin[i]) / locranges[i];
+              pv < 0. ? pv = 0. : pv = pv;
+              pv > 1. ? pv = 1. : pv = pv;
+              imagerows[i][j] = pv;
+            }
+            imageweights[i] = (selectedBaseline == -1 || selectedBaseline == i) && !health.masked[i] && (!weighByQuality || locStats.good[i]) ? 1. : 0.;
+          }
+
+          const float *cpumap = NULL;
+          if (cpuMapMode == CPUMAP_CLEAN) {
+            cpuImager.image(geometry, imagerows, imageweights, &dirtymap[0]);
+            int psfMisses = psfCache.misses;
+            std::shared_ptr<const PSF> psf = psfCache.get(geometry, cpuImager, imageweights);
+            if (psfCache.misses != psfMisses) {
+              std::cout << "New PSF: main lobe radius " << psf->mainLobeRadius << " px, clean beam sigma " << psf->beamSigma
+                        << " px, peak sidelobe " << psf->peakSidelobe << " (" << psfCache.hits << " cache hits, " << psfCache.misses << " misses)" << std::endl;
+            }
+            clean.run(cpuImager, *psf, &dirtymap[0]);
+            std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+            cpumap = &clean.restored[0];
+
+            // Report the brightest few components
+            if (glfwGetTime() - lastCPUMapReport >= 1.) {
+              lastCPUMapReport = glfwGetTime();
+              std::cout << "CLEAN " << clean.iterations << " it, " << clean.components.size() << " components, "
+                        << std::fixed << std::setprecision(1) << std::chrono::duration<double, std::micro>(t1 - t0).count() << " us:";
+              std::vector<bool> reported(clean.components.size(), false);
+              for (int n = 0; n < 3; n++) {
+                int best = -1;
+                for (size_t c = 0; c < clean.components.size(); c++) {
+                  if (!reported[c] && (best == -1 || clean.components[c].flux > clean.components[best].flux)) best = c;
+                }
+                if (best == -1) break;
+                reported[best] = true;
+                const CleanComponent &c = clean.components[best];
+                float r = sqrt(c.l * c.l + c.m * c.m);
+                std::cout << " [az " << atan2(c.m, c.l) * 180. / M_PI << " el " << acos(r > 1. ? 1. : r) * 180. / M_PI
+                          << " flux " << std::setprecision(3) << c.flux << std::setprecision(1) << "]";
+              }
+              std::cout << std::defaultfloat << std::endl;
+            }
+          } else if (cpuMapMode == CPUMAP_NEARFIELD) {
+            nearField.image(geometry, imagerows, imageweights);
+            std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+            cpumap = &nearField.focusMap[0];
+
+            // Report the sources with their best-focused range
+            if (glfwGetTime() - lastCPUMapReport >= 1.) {
+              lastCPUMapReport = glfwGetTime();
+              std::cout << "Near field " << std::fixed << std::setprecision(1) << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms:";
+              for (size_t i = 0; i < nearField.sources.size(); i++) {
+                const NearFieldSource &src = nearField.sources[i];
+                float r = sqrt(src.l * src.l + src.m * src.m);
+                std::cout << " [az " << atan2(src.m, src.l) * 180. / M_PI << " el " << acos(r > 1. ? 1. : r) * 180. / M_PI
+                          << " range " << std::setprecision(2) << src.range << " m, contrast " << src.contrast << std::setprecision(1) << "]";
+              }
+              std::cout << std::defaultfloat << std::endl;
+            }
+          }
+
+          // Normalise to the peak and upload
+          float peak = 0.;
+          for (int p = 0; p < CPUMAPSIZE * CPUMAPSIZE; p++) if (cpumap[p] > peak) peak = cpumap[p];
+          for (int p = 0; p < CPUMAPSIZE * CPUMAPSIZE; p++) cpumappixels[p] = peak > 0. ? cpumap[p] / peak : 0.;
+          glActiveTexture(GL_TEXTURE1);
+          glBindTexture(GL_TEXTURE_2D, cpumaptexture);
+          glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CPUMAPSIZE, CPUMAPSIZE, GL_RED, GL_FLOAT, &cpumappixels[0]);
+          glActiveTexture(GL_TEXTURE0);
+          frameTimer.end(cpuMapStage);
+        }
   
+        // Pick the render size from the imaging time of earlier frames
+        frameTimer.collect();
+        const std::vector<float> &imagingTimes = frameTimer.latest(imagingPass);
+        for (size_t i = 0; i < imagingTimes.size(); i++) renderTarget.addSample(imagingTimes[i]);
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        renderTarget.dynamic = dynamicResolution;
+        renderTarget.budget = renderBudget;
+        if (renderTarget.adapt()) {
+          std::cout << "Render scale " << renderTarget.scale << std::endl;
+        }
+        renderTarget.resize(fbWidth, fbHeight);
+
+        // Rerender the per-pixel lags when the array or the render size changed
+        if (projection == 0) {
+          glActiveTexture(GL_TEXTURE3);
+          if (pixelLags.update(geometry, renderTarget.width, renderTarget.height, VAO)) {
+            std::cout << "Rendered per-pixel lags for " << renderTarget.width << "x" << renderTarget.height << " pixels" << std::endl;
+          }
+          glActiveTexture(GL_TEXTURE0);
+          ourShader.use();
+          glUniform1i(plloc, pixelLags.enabled);
+        }
+
         // render container
         ourShader.use();
+        glUniform2f(vploc, renderTarget.width, renderTarget.height);
+        glUniform1f(rsloc, renderTarget.scale);
+        glUniform1i(nbloc, numBands);
+        glUniform1i(bdloc, banding ? bandMode : 0);
+        glUniform2f(amloc, ampScale, ampShift);
+        renderTarget.bind();
         glBindVertexArray(VAO);
+        frameTimer.begin(imagingPass);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        frameTimer.end(imagingPass);
+
+        // Fold the new map into the fading history and show that instead
+        double frameTime = glfwGetTime();
+        unsigned int mapFbo = renderTarget.fbo;
+        if (persistenceMode) {
+          accumulator.resize(renderTarget.width, renderTarget.height);
+          if (!wasPersistent) accumulator.clear();
+          float decay = exp(-(frameTime - lastFrameTime) / persistenceTime);
+          // the lag rows along the bottom always show the latest rows
+          float stripTop = 3. * renderTarget.scale * numBaselines;
+          frameTimer.begin(persistencePass);
+          mapFbo = accumulator.accumulate(renderTarget.texture, decay, persistenceMode == PERSIST_PEAK, stripTop, VAO);
+          frameTimer.end(persistencePass);
+        }
+        frameTimer.begin(displayPass);
+        renderTarget.blit(mapFbo);
+        wasPersistent = persistenceMode;
+        lastFrameTime = frameTime;
+
+        // Mic markers only make sense on the plan view of the dome
+        if (projection == 0) {
+          micOverlay.update(geometry, selectedMic, selectedBaseline);
+          micOverlay.draw(skyRadius, fbWidth, fbHeight);
+        }
+        frameTimer.end(displayPass);
+
+        // Record the frame as shown, or the map itself
+        if (captureMode != (frameCapture.active ? frameCapture.kind : -1)) {
+          frameCapture.stop();
+          if (captureMode != -1) frameCapture.start(captureMode);
+        }
+        if (captureMode != -1) {
+          frameTimer.begin(capturePass);
+          if (captureMode == CAPTURE_WINDOW) frameCapture.capture(0, fbWidth, fbHeight);
+          else frameCapture.capture(mapFbo, renderTarget.width, renderTarget.height);
+          frameTimer.end(capturePass);
+        }
+        frameCapture.poll();
+
+        if (timingReport && frameTime - lastReportTime >= 1.) {
+          frameTimer.report();
+          lastReportTime = frameTime;
+        }
+        if (statsRequested) {
+          std::cout << "Lag statistics of the " << (locIntegrated ? "integrated" : "latest") << " rows, "
+                    << locStats.numGood() << " of " << numBaselines << " baselines above SNR " << snrGood << std::endl;
+          for (int i = 0; i < numBaselines; i++) {
+            std::cout << "Baseline " << std::setw(4) << i << ": floor " << locStats.floor[i] << " noise " << locStats.noise[i]
+                      << " std dev " << sqrtf(locStats.variance[i]) << " peak at " << locStats.peakBin[i]
+                      << " SNR " << locStats.snr[i] << (locStats.good[i] || !weighByQuality ? "" : " (left out)");
+            if (peakMode) {
+              for (int k = 0; k < LagPeakTracker::MAXPEAKS; k++) {
+                if (!peakTracker.confirmed(i, k)) continue;
+                const LagPeakTracker::Track &t = peakTracker.track(i, k);
+                std::cout << ", track " << t.id << " at " << t.bin << " (" << t.age << " rows)";
+              }
+            }
+            if (health.baselineState[i] != HEALTH_OK || health.masked[i]) {
+              std::cout << ", " << ArrayHealth::name(health.baselineState[i]) << (health.masked[i] ? " (masked)" : "");
+            }
+            if (closureMode && closureCheck.micCount() == geometry.numMics) {
+              std::cout << ", closure failed " << closureCheck.failed[i] << " of " << closureCheck.tested[i]
+                        << (closureCheck.inconsistent[i] ? " (inconsistent)" : "");
+            }
+            std::cout << std::endl;
+          }
+          statsRequested = false;
+        }
   
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
+        frameTimer.begin(swapStage);
         glfwSwapBuffers(window);
+        frameTimer.end(swapStage);
         glfwPollEvents();
       }
   
       // optional: de-allocate all resources once they've outlived their purpose:
       // ------------------------------------------------------------------------
+      lagStream.destroy();
+      arrayUniforms.destroy();
+      micOverlay.destroy();
+      renderTarget.destroy();
+      accumulator.destroy();
+      frameCapture.destroy();
+      frameTimer.destroy();
       glDeleteVertexArrays(1, &VAO);
       glDeleteBuffers(1, &VBO);
       glDeleteBuffers(1, &EBO);
@@ -621,114 +1317,30 @@ void processInput(GLFWwindow *window)
     }
 
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-	if (selectedMic == 0) {
-	  micpos1[1] = micpos1[1] + 0.005f;
-          glUniform3f(m1loc, micpos1[0], micpos1[1], micpos1[2]);
-	} else if (selectedMic == 1) {
-	  micpos2[1] = micpos2[1] + 0.005f;
-          glUniform3f(m2loc, micpos2[0], micpos2[1], micpos2[2]);
-	} else if (selectedMic == 2) {
-	  micpos3[1] = micpos3[1] + 0.005f;
-          glUniform3f(m3loc, micpos3[0], micpos3[1], micpos3[2]);
-	} else if (selectedMic == 3) {
-	  micpos4[1] = micpos4[1] + 0.005f;
-          glUniform3f(m4loc, micpos4[0], micpos4[1], micpos4[2]);
-	} else if (selectedMic == 4) {
-	  micpos5[1] = micpos5[1] + 0.005f;
-          glUniform3f(m5loc, micpos5[0], micpos5[1], micpos5[2]);
-	} else if (selectedMic == 5) {
-	  micpos6[1] = micpos6[1] + 0.005f;
-          glUniform3f(m6loc, micpos6[0], micpos6[1], micpos6[2]);
-	} else if (selectedMic == 6) {
-	  micpos7[1] = micpos7[1] + 0.005f;
-          glUniform3f(m7loc, micpos7[0], micpos7[1], micpos7[2]);
-	} else if (selectedMic == 7) {
-	  micpos8[1] = micpos8[1] + 0.005f;
-          glUniform3f(m8loc, micpos8[0], micpos8[1], micpos8[2]);
+	if (selectedMic >= 0 && selectedMic < numMics) {
+	  micpos[selectedMic][1] = micpos[selectedMic][1] + 0.005f;
+          arrayUniforms.setMicPositions(micpos);
 	}
     }
 
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-	if (selectedMic == 0) {
-	  micpos1[1] = micpos1[1] - 0.005f;
-          glUniform3f(m1loc, micpos1[0], micpos1[1], micpos1[2]);
-	} else if (selectedMic == 1) {
-	  micpos2[1] = micpos2[1] - 0.005f;
-          glUniform3f(m2loc, micpos2[0], micpos2[1], micpos2[2]);
-	} else if (selectedMic == 2) {
-	  micpos3[1] = micpos3[1] - 0.005f;
-          glUniform3f(m3loc, micpos3[0], micpos3[1], micpos3[2]);
-	} else if (selectedMic == 3) {
-	  micpos4[1] = micpos4[1] - 0.005f;
-          glUniform3f(m4loc, micpos4[0], micpos4[1], micpos4[2]);
-	} else if (selectedMic == 4) {
-	  micpos5[1] = micpos5[1] - 0.005f;
-          glUniform3f(m5loc, micpos5[0], micpos5[1], micpos5[2]);
-	} else if (selectedMic == 5) {
-	  micpos6[1] = micpos6[1] - 0.005f;
-          glUniform3f(m6loc, micpos6[0], micpos6[1], micpos6[2]);
-	} else if (selectedMic == 6) {
-	  micpos7[1] = micpos7[1] - 0.005f;
-          glUniform3f(m7loc, micpos7[0], micpos7[1], micpos7[2]);
-	} else if (selectedMic == 7) {
-	  micpos8[1] = micpos8[1] - 0.005f;
-          glUniform3f(m8loc, micpos8[0], micpos8[1], micpos8[2]);
+	if (selectedMic >= 0 && selectedMic < numMics) {
+	  micpos[selectedMic][1] = micpos[selectedMic][1] - 0.005f;
+          arrayUniforms.setMicPositions(micpos);
 	}
     }
 
     if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-	if (selectedMic == 0) {
-	  micpos1[0] = micpos1[0] - 0.005f;
-          glUniform3f(m1loc, micpos1[0], micpos1[1], micpos1[2]);
-	} else if (selectedMic == 1) {
-	  micpos2[0] = micpos2[0] - 0.005f;
-          glUniform3f(m2loc, micpos2[0], micpos2[1], micpos2[2]);
-	} else if (selectedMic == 2) {
-	  micpos3[0] = micpos3[0] - 0.005f;
-          glUniform3f(m3loc, micpos3[0], micpos3[1], micpos3[2]);
-	} else if (selectedMic == 3) {
-	  micpos4[0] = micpos4[0] - 0.005f;
-          glUniform3f(m4loc, micpos4[0], micpos4[1], micpos4[2]);
-	} else if (selectedMic == 4) {
-	  micpos5[0] = micpos5[0] - 0.005f;
-          glUniform3f(m5loc, micpos5[0], micpos5[1], micpos5[2]);
-	} else if (selectedMic == 5) {
-	  micpos6[0] = micpos6[0] - 0.005f;
-          glUniform3f(m6loc, micpos6[0], micpos6[1], micpos6[2]);
-	} else if (selectedMic == 6) {
-	  micpos7[0] = micpos7[0] - 0.005f;
-          glUniform3f(m7loc, micpos7[0], micpos7[1], micpos7[2]);
-	} else if (selectedMic == 7) {
-	  micpos8[0] = micpos8[0] - 0.005f;
-          glUniform3f(m8loc, micpos8[0], micpos8[1], micpos8[2]);
+	if (selectedMic >= 0 && selectedMic < numMics) {
+	  micpos[selectedMic][0] = micpos[selectedMic][0] - 0.005f;
+          arrayUniforms.setMicPositions(micpos);
 	}
     }
 
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-	if (selectedMic == 0) {
-	  micpos1[0] = micpos1[0] + 0.005f;
-          glUniform3f(m1loc, micpos1[0], micpos1[1], micpos1[2]);
-	} else if (selectedMic == 1) {
-	  micpos2[0] = micpos2[0] + 0.005f;
-          glUniform3f(m2loc, micpos2[0], micpos2[1], micpos2[2]);
-	} else if (selectedMic == 2) {
-	  micpos3[0] = micpos3[0] + 0.005f;
-          glUniform3f(m3loc, micpos3[0], micpos3[1], micpos3[2]);
-	} else if (selectedMic == 3) {
-	  micpos4[0] = micpos4[0] + 0.005f;
-          glUniform3f(m4loc, micpos4[0], micpos4[1], micpos4[2]);
-	} else if (selectedMic == 4) {
-	  micpos5[0] = micpos5[0] + 0.005f;
-          glUniform3f(m5loc, micpos5[0], micpos5[1], micpos5[2]);
-	} else if (selectedMic == 5) {
-	  micpos6[0] = micpos6[0] + 0.005f;
-          glUniform3f(m6loc, micpos6[0], micpos6[1], micpos6[2]);
-	} else if (selectedMic == 6) {
-	  micpos7[0] = micpos7[0] + 0.005f;
-          glUniform3f(m7loc, micpos7[0], micpos7[1], micpos7[2]);
-	} else if (selectedMic == 7) {
-	  micpos8[0] = micpos8[0] + 0.005f;
-          glUniform3f(m8loc, micpos8[0], micpos8[1], micpos8[2]);
+	if (selectedMic >= 0 && selectedMic < numMics) {
+	  micpos[selectedMic][0] = micpos[selectedMic][0] + 0.005f;
+          arrayUniforms.setMicPositions(micpos);
 	}
     }
 
@@ -737,8 +1349,7 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           zDown = true;
 	  selectedMic = selectedMic - 1;
-	  if (selectedMic < -1) selectedMic = 7;
-	  glUniform1i(smloc, selectedMic);
+	  if (selectedMic < -1) selectedMic = numMics - 1;
 	  std::cout << " Selected mic number " << selectedMic + 1 << std::endl;
 	}
     }
@@ -755,8 +1366,7 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           xDown = true;
 	  selectedMic = selectedMic + 1;
-	  if (selectedMic > 7) selectedMic = -1;
-	  glUniform1i(smloc, selectedMic);
+	  if (selectedMic > numMics - 1) selectedMic = -1;
 	  std::cout << " Selected mic number " << selectedMic + 1 << std::endl;
 	}
     }
@@ -773,7 +1383,7 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           cDown = true;
 	  selectedBaseline = selectedBaseline - 1;
-	  if (selectedBaseline < -1) selectedBaseline = 27;
+	  if (selectedBaseline < -1) selectedBaseline = numBaselines - 1;
 	  glUniform1i(sbloc, selectedBaseline);
 	  std::cout << " Selected baseline number " << selectedBaseline << std::endl;
 	}
@@ -791,7 +1401,7 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           vDown = true;
 	  selectedBaseline = selectedBaseline + 1;
-	  if (selectedBaseline > 27) selectedBaseline = -1;
+	  if (selectedBaseline > numBaselines - 1) selectedBaseline = -1;
 	  glUniform1i(sbloc, selectedBaseline);
 	  std::cout << " Selected baseline number " << selectedBaseline << std::endl;
 	}
@@ -809,7 +1419,7 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           bDown = true;
 	  lagoffsets[selectedBaseline] = fmod(lagoffsets[selectedBaseline] - 1., float(NUMLAGS + 1));
-	  glUniform1fv(loloc, 28, lagoffsets);
+	  arrayUniforms.setCalibration(lagoffsets);
 	  std::cout << "Changed baseline " << selectedBaseline + 1 << " lag offset to " << lagoffsets[selectedBaseline] << std::endl;
 	}
     }
@@ -826,7 +1436,7 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           nDown = true;
 	  lagoffsets[selectedBaseline] = fmod(lagoffsets[selectedBaseline] + 1., float(NUMLAGS + 1));
-	  glUniform1fv(loloc, 28, lagoffsets);
+	  arrayUniforms.setCalibration(lagoffsets);
 	  std::cout << "Changed baseline " << selectedBaseline + 1 << " lag offset to " << lagoffsets[selectedBaseline] << std::endl;
 	}
     }
@@ -861,29 +1471,13 @@ void processInput(GLFWwindow *window)
           commaDown = true;
 	  if (ampSelected) {
             //Change the amplitude scale down
-	    if (selectedBaseline != -1) {
-              ampscales[selectedBaseline] = ampscales[selectedBaseline] / 1.1;
-	      std::cout << "Amp scale for baseline " << selectedBaseline << " reduced to " << ampscales[selectedBaseline] << std::endl;
-	    } else {
-	      for (int i = 0; i < 28; i++) {
-	        ampscales[i] = ampscales[i] / 1.1;
-	      }
-	      std::cout << "Adjusted amplitude scale for ALL baselines down by 10%" << std::endl;
-	    }
+	    ampScale = ampScale / 1.1;
+	    std::cout << "Amp scale reduced to " << ampScale << std::endl;
 	  } else {
             // Change the amplitude offset down
-	    if (selectedBaseline != -1) {
-	      ampshifts[selectedBaseline] = ampshifts[selectedBaseline] - 0.1;
-	      std::cout << "Amp offset for baseline " << selectedBaseline << " reduced to " << ampshifts[selectedBaseline] << std::endl;
-	    } else {
-	      for (int i = 0; i < 28; i++) {
-	        ampshifts[i] = ampshifts[i] - 0.1;
-	      }
-	      std::cout << "Adjusted amplitude shift for ALL baselines down by 0.1" << std::endl;
-	    }
+	    ampShift = ampShift - 0.1;
+	    std::cout << "Amp offset reduced to " << ampShift << std::endl;
 	  }
-	  glUniform1fv(ascloc, 28, ampscales);
-          glUniform1fv(ashloc, 28, ampshifts);
 	}
     }
 
@@ -899,30 +1493,14 @@ void processInput(GLFWwindow *window)
           // First press, do something here
           periodDown = true;
 	  if (ampSelected) {
-            //Change the amplitude scale down
-	    if (selectedBaseline != -1) {
-              ampscales[selectedBaseline] = ampscales[selectedBaseline] * 1.1;
-	      std::cout << "Amp scale for baseline " << selectedBaseline << " increased to " << ampscales[selectedBaseline] << std::endl;
-	    } else {
-	      for (int i = 0; i < 28; i++) {
-	        ampscales[i] = ampscales[i] * 1.1;
-	      }
-	      std::cout << "Adjusted amplitude scale for ALL baselines up by 10%" << std::endl;
-	    }
+            //Change the amplitude scale up
+	    ampScale = ampScale * 1.1;
+	    std::cout << "Amp scale increased to " << ampScale << std::endl;
 	  } else {
-            // Change the amplitude offset down
-	    if (selectedBaseline != -1) {
-	      ampshifts[selectedBaseline] = ampshifts[selectedBaseline] + 0.1;
-	      std::cout << "Amp offset for baseline " << selectedBaseline << " increased to " << ampshifts[selectedBaseline] << std::endl;
-	    } else {
-	      for (int i = 0; i < 28; i++) {
-	        ampshifts[i] = ampshifts[i] + 0.1;
-	      }
-	      std::cout << "Adjusted amplitude shift for ALL baselines up by 0.1" << std::endl;
-	    }
+            // Change the amplitude offset up
+	    ampShift = ampShift + 0.1;
+	    std::cout << "Amp offset increased to " << ampShift << std::endl;
 	  }
-	  glUniform1fv(ascloc, 28, ampscales);
-          glUniform1fv(ashloc, 28, ampshifts);
 	}
     }
 
@@ -983,29 +1561,318 @@ void processInput(GLFWwindow *window)
 	}
     }
 
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS) {
+	if (kDown == false) {
+          // First press, do something here
+          kDown = true;
+	  tdoaMode = (tdoaMode + 1) % 3;
+	  if (tdoaMode == 1) tdoaSolver.mode = TDOA_DIRECTION;
+	  if (tdoaMode == 2) tdoaSolver.mode = TDOA_POSITION;
+	  tdoaSolver.reset();
+	  if (tdoaMode == 0) std::cout << "TDOA localisation off" << std::endl;
+	  else if (tdoaMode == 1) std::cout << "TDOA localisation on, solving for direction" << std::endl;
+	  else std::cout << "TDOA localisation on, solving for position" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_RELEASE) {
+        if (kDown == true) {
+	  // First release, do something here
+	  kDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
+	if (qDown == false) {
+          // First press, do something here
+          qDown = true;
+	  cpuMapMode = (cpuMapMode == CPUMAP_CLEAN) ? CPUMAP_OFF : CPUMAP_CLEAN;
+	  glUniform1i(cmloc, cpuMapMode != CPUMAP_OFF);
+	  std::cout << "CLEAN mode toggled to " << (cpuMapMode == CPUMAP_CLEAN) << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_RELEASE) {
+        if (qDown == true) {
+	  // First release, do something here
+	  qDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS) {
+	if (fDown == false) {
+          // First press, do something here
+          fDown = true;
+	  cpuMapMode = (cpuMapMode == CPUMAP_NEARFIELD) ? CPUMAP_OFF : CPUMAP_NEARFIELD;
+	  glUniform1i(cmloc, cpuMapMode != CPUMAP_OFF);
+	  std::cout << "Near-field focusing toggled to " << (cpuMapMode == CPUMAP_NEARFIELD) << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_RELEASE) {
+        if (fDown == true) {
+	  // First release, do something here
+	  fDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+	if (aDown == false) {
+          // First press, do something here
+          aDown = true;
+	  projection = 1 - projection;
+	  glUniform1i(prloc, projection);
+	  if (projection == 1) std::cout << "Switched to azimuth/elevation projection" << std::endl;
+	  else std::cout << "Switched to sky dome projection" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_RELEASE) {
+        if (aDown == true) {
+	  // First release, do something here
+	  aDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
+	if (dDown == false) {
+          // First press, do something here
+          dDown = true;
+	  dynamicResolution = !dynamicResolution;
+	  if (dynamicResolution) std::cout << "Dynamic resolution on, imaging budget " << renderBudget << " ms" << std::endl;
+	  else std::cout << "Dynamic resolution off, imaging at window resolution" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_RELEASE) {
+        if (dDown == true) {
+	  // First release, do something here
+	  dDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) {
+	if (iDown == false) {
+          // First press, do something here
+          iDown = true;
+	  persistenceMode = (persistenceMode + 1) % 3;
+	  if (persistenceMode == PERSIST_AVERAGE) std::cout << "Map persistence on, averaging over " << persistenceTime << " s" << std::endl;
+	  else if (persistenceMode == PERSIST_PEAK) std::cout << "Map persistence on, holding peaks over " << persistenceTime << " s" << std::endl;
+	  else std::cout << "Map persistence off" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE) {
+        if (iDown == true) {
+	  // First release, do something here
+	  iDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS) {
+	if (leftBracketDown == false) {
+          // First press, do something here
+          leftBracketDown = true;
+	  if (persistenceTime > 0.05) persistenceTime = persistenceTime / 2.;
+	  std::cout << "Map persistence time " << persistenceTime << " s" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_RELEASE) {
+        if (leftBracketDown == true) {
+	  // First release, do something here
+	  leftBracketDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS) {
+	if (rightBracketDown == false) {
+          // First press, do something here
+          rightBracketDown = true;
+	  if (persistenceTime < 60.) persistenceTime = persistenceTime * 2.;
+	  std::cout << "Map persistence time " << persistenceTime << " s" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_RELEASE) {
+        if (rightBracketDown == true) {
+	  // First release, do something here
+	  rightBracketDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
+	if (rDown == false) {
+          // First press, do something here
+          rDown = true;
+	  // Cycle: off, window as PNG, raw float map
+	  if (captureMode == -1) captureMode = CAPTURE_WINDOW;
+	  else if (captureMode == CAPTURE_WINDOW) captureMode = CAPTURE_MAP;
+	  else captureMode = -1;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE) {
+        if (rDown == true) {
+	  // First release, do something here
+	  rDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+	if (oDown == false) {
+          // First press, do something here
+          oDown = true;
+	  timingReport = !timingReport;
+	  if (timingReport) std::cout << "Reporting stage timings" << std::endl;
+	  else std::cout << "Stopped reporting stage timings" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE) {
+        if (oDown == true) {
+	  // First release, do something here
+	  oDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS) {
+	if (yDown == false) {
+          // First press, do something here
+          yDown = true;
+	  // Y: integration window for display, shift-Y: for localisation
+	  bool shift = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS;
+	  int &selected = shift ? localizationWindow : displayWindow;
+	  selected = selected + 1;
+	  if (selected >= (int)integrationWindows.size()) selected = -1;
+	  std::cout << (shift ? "Localisation" : "Display") << " uses ";
+	  if (selected == -1) std::cout << "the latest dumps" << std::endl;
+	  else std::cout << integrationWindows[selected] * 1000. << " ms integration" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_RELEASE) {
+        if (yDown == true) {
+	  // First release, do something here
+	  yDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+	if (wDown == false) {
+          // First press, do something here
+          wDown = true;
+	  gccPhat = !gccPhat;
+	  std::cout << "GCC-PHAT whitening " << (gccPhat ? "on" : "off") << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_RELEASE) {
+        if (wDown == true) {
+	  // First release, do something here
+	  wDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS) {
+	if (uDown == false) {
+          // First press, do something here
+          uDown = true;
+	  // 1x -> 4x -> 8x -> 1x
+	  upsampleFactor = upsampleFactor == 1 ? 4 : (upsampleFactor == 4 ? 8 : 1);
+	  std::cout << "Lag upsampling " << upsampleFactor << "x" << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_RELEASE) {
+        if (uDown == true) {
+	  // First release, do something here
+	  uDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+	if (sDown == false) {
+          // First press, do something here
+          sDown = true;
+	  statsRequested = true;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_RELEASE) {
+        if (sDown == true) {
+	  // First release, do something here
+	  sDown = false;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_SEMICOLON) == GLFW_PRESS) {
+	if (semicolonDown == false) {
+          // First press, do something here
+          semicolonDown = true;
+	  closureMode = !closureMode;
+	  std::cout << "Closure check " << (closureMode ? "on" : "off") << std::endl;
+	}
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_SEMICOLON) == GLFW_RELEASE) {
+        if (semicolonDown == true) {
+	  // First release, do something here
+	  semicolonDown = false;
+	}
+    }
+
+    // 0: filter bank off / all bands combined, 1-9: image a single band
+    for (int d = 0; d < 10; d++) {
+      if (glfwGetKey(window, GLFW_KEY_0 + d) == GLFW_PRESS) {
+	if (digitDown[d] == false) {
+          // First press, do something here
+          digitDown[d] = true;
+	  if (d == 0) {
+	    bandMode = bandMode == BANDS_OFF ? BANDS_COMBINED : BANDS_OFF;
+	  } else if (d <= filterBank.numBands()) {
+	    bandMode = d - 1;
+	  }
+	  if (bandMode == BANDS_OFF) std::cout << "Broadband imaging" << std::endl;
+	  else if (bandMode == BANDS_COMBINED) std::cout << "Imaging " << filterBank.numBands() << " bands combined" << std::endl;
+	  else std::cout << "Imaging band " << bandMode + 1 << ": " << filterBank.low(bandMode) << " - "
+	                 << filterBank.high(bandMode) << " Hz" << std::endl;
+	}
+      }
+
+      if (glfwGetKey(window, GLFW_KEY_0 + d) == GLFW_RELEASE) {
+        if (digitDown[d] == true) {
+	  // First release, do something here
+	  digitDown[d] = false;
+	}
+      }
+    }
+
     if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS) {
 	if (lDown == false) {
           // First press, do something here
           lDown = true;
 	  // Output all configurable settings
 	  std::cout << "Sky radius: " << skyRadius << std::endl;
-	  std::cout << "Mic pos 1: " << micpos1[0] << " " << micpos1[1] << " " << micpos1[2] << std::endl;
-	  std::cout << "Mic pos 2: " << micpos2[0] << " " << micpos2[1] << " " << micpos2[2] << std::endl;
-	  std::cout << "Mic pos 3: " << micpos3[0] << " " << micpos3[1] << " " << micpos3[2] << std::endl;
-	  std::cout << "Mic pos 4: " << micpos4[0] << " " << micpos4[1] << " " << micpos4[2] << std::endl;
-	  std::cout << "Mic pos 5: " << micpos5[0] << " " << micpos5[1] << " " << micpos5[2] << std::endl;
-	  std::cout << "Mic pos 6: " << micpos6[0] << " " << micpos6[1] << " " << micpos6[2] << std::endl;
-	  std::cout << "Mic pos 7: " << micpos7[0] << " " << micpos7[1] << " " << micpos7[2] << std::endl;
-	  std::cout << "Mic pos 8: " << micpos8[0] << " " << micpos8[1] << " " << micpos8[2] << std::endl;
-	  for (int i = 0; i < 28; i++) {
-	    std::cout << "Lag offset " << std::setw(2) << i << ": " << lagoffsets[i] << std::endl;
+	  std::cout << "Imaging budget: " << renderBudget << " ms" << std::endl;
+	  std::cout << "Persistence time: " << persistenceTime << " s" << std::endl;
+	  std::cout << "GCC-PHAT floor: " << phatFloor << std::endl;
+	  std::cout << "Peaks per baseline: " << numPeaks << std::endl;
+	  std::cout << "Baseline SNR threshold: " << snrGood << std::endl;
+	  std::cout << "Closure tolerance: " << closureTolerance << " lags" << std::endl;
+	  std::cout << "Health auto-masking: " << (autoMask ? "on" : "off") << ", variance ratio " << varianceRatio << std::endl;
+	  std::cout << "Lag upsampling: " << upsampleFactor << "x" << std::endl;
+	  for (int i = 0; i < filterBank.numBands(); i++) {
+	    std::cout << "Band " << i + 1 << ": " << filterBank.low(i) << " - " << filterBank.high(i) << " Hz" << std::endl;
 	  }
-	  for (int i = 0; i < 28; i++) {
-	    std::cout << "Amp scale " << std::setw(5) << i << ": " << ampscales[i] << std::endl;
+	  for (int i = 0; i < numMics; i++) {
+	    std::cout << "Mic pos " << i + 1 << ": " << micpos[i][0] << " " << micpos[i][1] << " " << micpos[i][2] << std::endl;
 	  }
-	  for (int i = 0; i < 28; i++) {
-	    std::cout << "Amp offset " << std::setw(5) << i << ": " << ampshifts[i] << std::endl;
+	  for (int i = 0; i < numBaselines; i++) {
+	    std::cout << "Lag offset " << std::setw(2) << i << ": " << lagoffsets[i] << std::endl;
 	  }
+	  std::cout << "Amp scale: " << ampScale << ", amp offset: " << ampShift << std::endl;
+	  std::cout << "Correlation coefficients: " << (!normalizeLags ? "off" : (normalizer.ready() ? "on" : "waiting for mic powers")) << std::endl;
 	}
     }
 
@@ -0,0 +1,158 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "array_geometry.h"
+
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Closure delays: for mics i < j < k the geometric lags of baselines i-j,
+// j-k and i-k satisfy lag(ij) + lag(jk) - lag(ik) = 0 for any source, so the
+// peak lags (after the lag offsets) should too. A wrong lag offset or a bad
+// mic breaks every triangle through that baseline or mic, while a good
+// baseline only fails the triangles it shares with a bad one.
+//
+// The triangle table (C(n, 3) entries, 56 at 8 mics) is built once per mic
+// count, as three baseline index arrays. evaluate() gathers four triangles at
+// a time into SSE2 lanes, then tallies per baseline how many of its
+// triangles were tested and how many closed worse than 'tolerance' lags. A
+// baseline failing more than badFraction of at least two triangles is
+// flagged inconsistent. Triangles with a baseline of weight <= 0 are skipped.
+
+class ClosureCheck
+{
+public:
+    float tolerance;        // lags; three refined peaks add their errors
+    float badFraction;
+
+    // per triangle
+    std::vector<float> closure;     // lags
+    // per baseline
+    std::vector<int> tested, failed;
+    std::vector<char> inconsistent;
+    // over all triangles tested
+    int numTested, numFailed;
+    float rms;
+
+    ClosureCheck() : tolerance(1.5f), badFraction(0.5f), numTested(0), numFailed(0), rms(0.f), numMics(0), numBaselines(0) {}
+
+    // triangle table for the mics and baselines of geom
+    // ------------------------------------------------------------------------
+    void setGeometry(const ArrayGeometry &geom)
+    {
+        numMics = geom.numMics;
+        numBaselines = geom.numBaselines;
+        std::vector<int> index((size_t)numMics * numMics, -1);
+        for (int b = 0; b < numBaselines; b++) {
+            index[geom.baselineMics[b][0] * numMics + geom.baselineMics[b][1]] = b;
+        }
+        ij.clear();
+        jk.clear();
+        ik.clear();
+        mics.clear();
+        for (int i = 0; i < numMics; i++) {
+            for (int j = i + 1; j < numMics; j++) {
+                for (int k = j + 1; k < numMics; k++) {
+                    ij.push_back(index[i * numMics + j]);
+                    jk.push_back(index[j * numMics + k]);
+                    ik.push_back(index[i * numMics + k]);
+                    mics.push_back(i);
+                    mics.push_back(j);
+                    mics.push_back(k);
+                }
+            }
+        }
+        closure.assign(ij.size(), 0.f);
+        tested.assign(numBaselines, 0);
+        failed.assign(numBaselines, 0);
+        inconsistent.assign(numBaselines, 0);
+    }
+    // ------------------------------------------------------------------------
+    int micCount() const
+    {
+        return numMics;
+    }
+    // ------------------------------------------------------------------------
+    int numTriangles() const
+    {
+        return ij.size();
+    }
+    // mic n (0-2) of triangle t
+    // ------------------------------------------------------------------------
+    int mic(int t, int n) const
+    {
+        return mics[(size_t)t * 3 + n];
+    }
+    // close every triangle on the peak lags (in samples, offsets removed)
+    // ------------------------------------------------------------------------
+    void evaluate(const float *lags, const float *weights)
+    {
+        for (int b = 0; b < numBaselines; b++) {
+            tested[b] = 0;
+            failed[b] = 0;
+        }
+        numTested = 0;
+        numFailed = 0;
+        double sum2 = 0.;
+        const int n = numTriangles();
+        int t = 0;
+#if defined(__SSE2__)
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        const __m128 tol = _mm_set1_ps(tolerance);
+        const __m128 zero = _mm_setzero_ps();
+        for (; t + 4 <= n; t += 4) {
+            const int *a = &ij[t], *b = &jk[t], *c = &ik[t];
+            __m128 la = _mm_set_ps(lags[a[3]], lags[a[2]], lags[a[1]], lags[a[0]]);
+            __m128 lb = _mm_set_ps(lags[b[3]], lags[b[2]], lags[b[1]], lags[b[0]]);
+            __m128 lc = _mm_set_ps(lags[c[3]], lags[c[2]], lags[c[1]], lags[c[0]]);
+            __m128 wa = _mm_set_ps(weights[a[3]], weights[a[2]], weights[a[1]], weights[a[0]]);
+            __m128 wb = _mm_set_ps(weights[b[3]], weights[b[2]], weights[b[1]], weights[b[0]]);
+            __m128 wc = _mm_set_ps(weights[c[3]], weights[c[2]], weights[c[1]], weights[c[0]]);
+            __m128 d = _mm_sub_ps(_mm_add_ps(la, lb), lc);
+            _mm_storeu_ps(&closure[t], d);
+            __m128 valid = _mm_cmpgt_ps(_mm_min_ps(wa, _mm_min_ps(wb, wc)), zero);
+            __m128 bad = _mm_and_ps(valid, _mm_cmpgt_ps(_mm_and_ps(d, absMask), tol));
+            int validBits = _mm_movemask_ps(valid);
+            if (validBits == 0) continue;
+            int badBits = _mm_movemask_ps(bad);
+            for (int lane = 0; lane < 4; lane++) {
+                if (validBits & (1 << lane)) tally(t + lane, (badBits >> lane) & 1, sum2);
+            }
+        }
+#endif
+        for (; t < n; t++) {
+            closure[t] = lags[ij[t]] + lags[jk[t]] - lags[ik[t]];
+            if (weights[ij[t]] <= 0.f || weights[jk[t]] <= 0.f || weights[ik[t]] <= 0.f) continue;
+            tally(t, fabsf(closure[t]) > tolerance, sum2);
+        }
+        rms = numTested > 0 ? sqrt(sum2 / numTested) : 0.;
+        for (int b = 0; b < numBaselines; b++) {
+            inconsistent[b] = tested[b] >= 2 && failed[b] > badFraction * tested[b];
+        }
+    }
+
+private:
+    int numMics, numBaselines;
+    std::vector<int> ij, jk, ik;    // baselines of each triangle
+    std::vector<int> mics;          // [triangle][3]
+
+    void tally(int t, bool bad, double &sum2)
+    {
+        numTested++;
+        sum2 += (double)closure[t] * closure[t];
+        tested[ij[t]]++;
+        tested[jk[t]]++;
+        tested[ik[t]]++;
+        if (!bad) return;
+        numFailed++;
+        failed[ij[t]]++;
+        failed[jk[t]]++;
+        failed[ik[t]]++;
+    }
+};
+
+#endif
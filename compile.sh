@@ -10,4 +10,4 @@
 #/usr/bin/g++ client-ethernet.cpp -o client-ethernet -L/Users/christiaanbrinkerink/Code-projects/FPGA-audio/full-correlator/Client -framework Cocoa -framework IOKit -framework OpenGL -framework CoreVideo /opt/local/lib/libglfw.dylib /opt/local/lib/libassimp.dylib /opt/local/lib/libfreetype.dylib libSTB_IMAGE.a libGLAD.a
 
 # For 8-mic ethernet client
-/usr/bin/g++ -std=c++11 client-ethernet-scalable.cpp -o client-ethernet-scalable -g -L/Users/christiaanbrinkerink/Code-projects/FPGA-audio/full-correlator/Client -framework Cocoa -framework IOKit -framework OpenGL -framework CoreVideo /opt/local/lib/libglfw.dylib /opt/local/lib/libassimp.dylib /opt/local/lib/libfreetype.dylib libSTB_IMAGE.a libGLAD.a
+/usr/bin/g++ -std=c++11 -O2 -pthread client-ethernet-scalable.cpp -o client-ethernet-scalable -g -L/Users/christiaanbrinkerink/Code-projects/FPGA-audio/full-correlator/Client -framework Cocoa -framework IOKit -framework OpenGL -framework CoreVideo /opt/local/lib/libglfw.dylib /opt/local/lib/libassimp.dylib /opt/local/lib/libfreetype.dylib libSTB_IMAGE.a libGLAD.a -lz
@@ -0,0 +1,105 @@
+#ifndef CPU_IMAGER_H
+#define CPU_IMAGER_H
+
+#include "array_geometry.h"
+
+#include <vector>
+#include <cmath>
+
+// CPU version of the delay-sum map the fragment shader draws, on a square grid
+// of direction cosines (l, m) in [-1, 1] x [-1, 1]. This is the orthographic
+// sky dome of the shader with the dome radius divided out: pixel (l, m) looks
+// at the dome point skyradius * (l, m, sqrt(1 - l^2 - m^2)).
+//
+// The lag index every pixel reads for every baseline only depends on the
+// geometry, so it is cached and recomputed only when the array changes.
+
+class CPUImager
+{
+public:
+    int size;            // map is size x size pixels
+    bool removeMean;     // subtract each lag row's mean, so empty sky maps to zero
+
+    CPUImager(int mapsize = 128) : size(mapsize), removeMean(true), cacheValid(false) {}
+
+    // direction cosines of the centre of pixel (ix, iy)
+    // ------------------------------------------------------------------------
+    float pixelL(int ix) const { return -1.f + (ix + 0.5f) * 2.f / size; }
+    float pixelM(int iy) const { return -1.f + (iy + 0.5f) * 2.f / size; }
+    float pixelSize() const { return 2.f / size; }
+    // form the dirty map from normalised lag rows; weights[b] <= 0 drops a
+    // baseline. Pixels outside the dome are set to zero.
+    // ------------------------------------------------------------------------
+    void image(const ArrayGeometry &geom, const float (*rows)[NUMLAGS], const float *weights, float *map)
+    {
+        updateCache(geom);
+        int npix = size * size;
+        for (int p = 0; p < npix; p++) map[p] = 0.;
+
+        float wsum = 0.;
+        for (int b = 0; b < geom.numBaselines; b++) {
+            if (weights[b] <= 0.) continue;
+            wsum += weights[b];
+            float mean = 0.;
+            if (removeMean) {
+                for (int j = 0; j < NUMLAGS; j++) mean += rows[b][j];
+                mean /= NUMLAGS;
+            }
+            const float *row = rows[b];
+            const int *i0 = &lagIndex0[(size_t)b * npix];
+            const float *fr = &lagFrac[(size_t)b * npix];
+            float w = weights[b];
+            for (int p = 0; p < npix; p++) {
+                // bilinear lookup with wrap-around, like the GL_REPEAT texture
+                int a = i0[p];
+                int c = (a + 1 == NUMLAGS) ? 0 : a + 1;
+                float v = row[a] + fr[p] * (row[c] - row[a]);
+                map[p] += w * (v - mean);
+            }
+        }
+        if (wsum > 0.) {
+            float scale = 1.f / wsum;
+            for (int p = 0; p < npix; p++) map[p] = inside[p] ? map[p] * scale : 0.f;
+        }
+    }
+    // true if pixel p lies on the dome
+    // ------------------------------------------------------------------------
+    bool onDome(int p) const { return inside[p] != 0; }
+
+private:
+    bool cacheValid;
+    ArrayGeometry cachedGeometry;
+    std::vector<int> lagIndex0;
+    std::vector<float> lagFrac;
+    std::vector<unsigned char> inside;
+
+    void updateCache(const ArrayGeometry &geom)
+    {
+        int npix = size * size;
+        if (cacheValid && (int)inside.size() == npix && geom.sameAs(cachedGeometry)) return;
+        cachedGeometry = geom;
+        lagIndex0.resize((size_t)geom.numBaselines * npix);
+        lagFrac.resize((size_t)geom.numBaselines * npix);
+        inside.resize(npix);
+        for (int iy = 0; iy < size; iy++) {
+            for (int ix = 0; ix < size; ix++) {
+                int p = iy * size + ix;
+                float l = pixelL(ix), m = pixelM(iy);
+                float r2 = l * l + m * m;
+                inside[p] = r2 <= 1.f;
+                float pos[3] = {geom.skyRadius * l, geom.skyRadius * m, r2 <= 1.f ? geom.skyRadius * sqrtf(1.f - r2) : 0.f};
+                for (int b = 0; b < geom.numBaselines; b++) {
+                    float idx = geom.lagIndex(b, geom.lag(b, pos));
+                    float fl = floorf(idx);
+                    int i0 = (int)fl;
+                    i0 = ((i0 % NUMLAGS) + NUMLAGS) % NUMLAGS;
+                    lagIndex0[(size_t)b * npix + p] = i0;
+                    lagFrac[(size_t)b * npix + p] = idx - fl;
+                }
+            }
+        }
+        cacheValid = true;
+    }
+};
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Cross-power spectra of all baselines at once: the Fourier transform of a
+// baseline's lag function is its cross-power spectrum, so one real FFT per
+// lag row gives NUMLAGS / 2 + 1 complex bins, DC to Nyquist.
+//
+// Each row of NUMLAGS real lags is packed into a complex sequence of half the
+// length (even lags real, odd lags imaginary), transformed with an iterative
+// radix-2 FFT and split into the spectrum of the real row afterwards. All
+// baselines go through each butterfly stage together, on split real and
+// imaginary planes laid out baseline-major and 16-byte aligned, so the
+// butterflies of a stage are contiguous and run four at a time with SSE2.
+// Twiddles, the bit-reversal table and the split factors are computed once.
+//
+// Rows are taken like the decoder leaves them: bins 0-4 are zeroed and the
+// mean of the rest is removed (optional), and each row can be referenced to
+// its zero-lag bin (the lag offset of the baseline), which turns a delay into
+// a phase slope. The spectra are not scaled.
+//
+// The way back runs the same stages on the conjugate. whiten() weights every
+// bin by one over its magnitude on the way (GCC-PHAT, the phase transform):
+// what is left of a lag row is where its phase says the delay is, so broad
+// and reverberant peaks come out sharp. A floor relative to the mean
+// magnitude keeps near-empty bins from being blown up to full weight.
+// filter() weights the bins with one or more sets of gains (a filter bank)
+// and brings every set back in the same batch, so N bands cost N inverse
+// transforms' worth of butterflies but one pass over the stages.
+
+#ifndef NUMLAGS
+#define NUMLAGS 256
+#endif
+
+class LagSpectra
+{
+public:
+    static const int BINS = NUMLAGS / 2 + 1;        // DC .. Nyquist
+    static const int STRIDE = (BINS + 3) & ~3;      // floats per spectrum row
+
+    bool removeMean;    // subtract each lag row's mean before transforming
+    float phatFloor;    // whiten() divides by |X| + phatFloor * mean |X|
+    int numBaselines;
+
+    LagSpectra() : removeMean(true), phatFloor(0.1f), numBaselines(0), workRows(0), rotated(false)
+    {
+        // stage with half length h keeps its h twiddles at [h, 2h), so
+        // every stage from h = 4 on starts on a whole SIMD vector (the
+        // first two stages need none)
+        twr = align(twiddleStore[0], 2 * HALF);
+        twi = align(twiddleStore[1], 2 * HALF);
+        for (int h = 1; h < HALF; h *= 2) {
+            for (int j = 0; j < h; j++) {
+                double a = -M_PI * j / h;
+                twr[h + j] = cos(a);
+                twi[h + j] = sin(a);
+            }
+        }
+        int bits = 0;
+        while ((1 << bits) < HALF) bits++;
+        for (int n = 0; n < HALF; n++) {
+            int r = 0;
+            for (int i = 0; i < bits; i++) if (n & (1 << i)) r |= 1 << (bits - 1 - i);
+            reversed[n] = r;
+        }
+        for (int k = 0; k < BINS; k++) {
+            double a = -2. * M_PI * k / NUMLAGS;
+            splitr[k] = cos(a);
+            spliti[k] = sin(a);
+        }
+    }
+    // transform rows[0 .. baselines - 1]; centres[b] is the bin of zero lag
+    // of baseline b, or centres is NULL to reference all rows to bin 0
+    // ------------------------------------------------------------------------
+    void transform(const float (*rows)[NUMLAGS], int baselines, const float *centres)
+    {
+        if (baselines != numBaselines) resize(baselines);
+        load(rows);
+        firstStages(numBaselines);
+        for (int h = 4; h < HALF; h *= 2) stage(h, numBaselines);
+        rotated = centres != NULL;
+        if (rotated) updateRotation(centres);
+        split(rotated);
+    }
+    // lag rows back from the spectra of the last transform(), in the layout
+    // the rows went in with (less the mean, if removed)
+    // ------------------------------------------------------------------------
+    void inverse(float (*rows)[NUMLAGS])
+    {
+        backward(rows, NULL, 1, false);
+    }
+    // same with every bin divided by its magnitude (GCC-PHAT); leaves the
+    // spectra themselves as they are
+    // ------------------------------------------------------------------------
+    void whiten(float (*rows)[NUMLAGS])
+    {
+        backward(rows, NULL, 1, true);
+    }
+    // lag rows for each of numSets sets of bin gains (gains[s * BINS + k]),
+    // set-major: rows[s * numBaselines + b]; whitened first if phat
+    // ------------------------------------------------------------------------
+    void filter(float (*rows)[NUMLAGS], const float *gains, int numSets, bool phat)
+    {
+        backward(rows, gains, numSets, phat);
+    }
+    // real and imaginary parts of the spectrum of baseline b, BINS each
+    // ------------------------------------------------------------------------
+    const float *real(int b) const
+    {
+        return specr + (size_t)b * STRIDE;
+    }
+    const float *imag(int b) const
+    {
+        return speci + (size_t)b * STRIDE;
+    }
+    // ------------------------------------------------------------------------
+    float power(int b, int k) const
+    {
+        float re = real(b)[k], im = imag(b)[k];
+        return re * re + im * im;
+    }
+
+private:
+    static const int HALF = NUMLAGS / 2;    // length of the complex FFT
+
+    std::vector<float> twiddleStore[2], workStore[2], spectrumStore[2], rotationStore[2];
+    float *twr, *twi;                       // stage twiddles
+    float *workr, *worki;                   // [row][HALF], one row per baseline
+                                            // and set on the way back
+    int workRows;
+    float *specr, *speci;                   // [baseline][STRIDE]
+    float *rotr, *roti;                     // [baseline][STRIDE]
+    std::vector<float> lastCentres;
+    bool rotated;                           // spectra are referenced to zero lag
+    int reversed[HALF];
+    float splitr[BINS], spliti[BINS];
+    float binr[BINS], bini[BINS];           // one weighted spectrum, for backward()
+
+    // 16-byte aligned view of n floats in v
+    static float *align(std::vector<float> &v, size_t n)
+    {
+        v.assign(n + 4, 0.f);
+        uintptr_t p = (uintptr_t)&v[0];
+        return (float *)((p + 15) & ~(uintptr_t)15);
+    }
+    void resize(int baselines)
+    {
+        numBaselines = baselines;
+        reserveWork(baselines);
+        specr = align(spectrumStore[0], (size_t)baselines * STRIDE);
+        speci = align(spectrumStore[1], (size_t)baselines * STRIDE);
+        rotr = align(rotationStore[0], (size_t)baselines * STRIDE);
+        roti = align(rotationStore[1], (size_t)baselines * STRIDE);
+        lastCentres.clear();
+    }
+    void reserveWork(int count)
+    {
+        if (count <= workRows) return;
+        workRows = count;
+        workr = align(workStore[0], (size_t)count * HALF);
+        worki = align(workStore[1], (size_t)count * HALF);
+    }
+    // even lags to the real plane, odd lags to the imaginary plane, in
+    // bit-reversed order
+    void load(const float (*rows)[NUMLAGS])
+    {
+        for (int b = 0; b < numBaselines; b++) {
+            const float *row = rows[b];
+            float mean = 0.f;
+            if (removeMean) mean = sum(row + 5, NUMLAGS - 5) / (NUMLAGS - 5);
+            float *re = workr + (size_t)b * HALF;
+            float *im = worki + (size_t)b * HALF;
+            for (int n = 0; n < HALF; n++) {
+                re[reversed[n]] = row[2 * n] - mean;
+                im[reversed[n]] = row[2 * n + 1] - mean;
+            }
+            // bins 0-4
+            re[reversed[0]] = im[reversed[0]] = 0.f;
+            re[reversed[1]] = im[reversed[1]] = 0.f;
+            re[reversed[2]] = 0.f;
+        }
+    }
+    // four partial sums, so the adds do not wait on each other
+    static float sum(const float *v, int n)
+    {
+        int i = 0;
+#if defined(__SSE2__)
+        __m128 vs = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) vs = _mm_add_ps(vs, _mm_loadu_ps(v + i));
+        float part[4];
+        _mm_storeu_ps(part, vs);
+        float total = part[0] + part[1] + part[2] + part[3];
+#else
+        float part[4] = { 0.f, 0.f, 0.f, 0.f };
+        for (; i + 4 <= n; i += 4) {
+            for (int p = 0; p < 4; p++) part[p] += v[i + p];
+        }
+        float total = part[0] + part[1] + part[2] + part[3];
+#endif
+        for (; i < n; i++) total += v[i];
+        return total;
+    }
+    // stages of half length 1 and 2 as one radix-4 pass; their twiddles are
+    // 1 and -i, so there is nothing to multiply
+    void firstStages(int count)
+    {
+        for (int b = 0; b < count; b++) {
+            float *re = workr + (size_t)b * HALF;
+            float *im = worki + (size_t)b * HALF;
+            for (int s = 0; s < HALF; s += 4) {
+                float *r = re + s, *i = im + s;
+                float r0 = r[0] + r[1], i0 = i[0] + i[1];
+                float r1 = r[0] - r[1], i1 = i[0] - i[1];
+                float r2 = r[2] + r[3], i2 = i[2] + i[3];
+                float r3 = r[2] - r[3], i3 = i[2] - i[3];
+                r[0] = r0 + r2;
+                i[0] = i0 + i2;
+                r[2] = r0 - r2;
+                i[2] = i0 - i2;
+                // (r3, i3) * -i = (i3, -r3)
+                r[1] = r1 + i3;
+                i[1] = i1 - r3;
+                r[3] = r1 - i3;
+                i[3] = i1 + r3;
+            }
+        }
+    }
+    // all butterflies of half length h, over the first count rows
+    void stage(int h, int count)
+    {
+        const float *wr = twr + h, *wi = twi + h;
+        for (int b = 0; b < count; b++) {
+            float *re = workr + (size_t)b * HALF;
+            float *im = worki + (size_t)b * HALF;
+            for (int s = 0; s < HALF; s += 2 * h) {
+                float *ar = re + s, *ai = im + s, *br = re + s + h, *bi = im + s + h;
+                int j = 0;
+#if defined(__SSE2__)
+                for (; j + 4 <= h; j += 4) {
+                    __m128 vwr = _mm_load_ps(wr + j), vwi = _mm_load_ps(wi + j);
+                    __m128 vbr = _mm_load_ps(br + j), vbi = _mm_load_ps(bi + j);
+                    __m128 tr = _mm_sub_ps(_mm_mul_ps(vbr, vwr), _mm_mul_ps(vbi, vwi));
+                    __m128 ti = _mm_add_ps(_mm_mul_ps(vbr, vwi), _mm_mul_ps(vbi, vwr));
+                    __m128 var = _mm_load_ps(ar + j), vai = _mm_load_ps(ai + j);
+                    _mm_store_ps(br + j, _mm_sub_ps(var, tr));
+                    _mm_store_ps(bi + j, _mm_sub_ps(vai, ti));
+                    _mm_store_ps(ar + j, _mm_add_ps(var, tr));
+                    _mm_store_ps(ai + j, _mm_add_ps(vai, ti));
+                }
+#endif
+                for (; j < h; j++) {
+                    float tr = br[j] * wr[j] - bi[j] * wi[j];
+                    float ti = br[j] * wi[j] + bi[j] * wr[j];
+                    br[j] = ar[j] - tr;
+                    bi[j] = ai[j] - ti;
+                    ar[j] += tr;
+                    ai[j] += ti;
+                }
+            }
+        }
+    }
+    // spectrum of the real row from the half-length complex one:
+    // X[k] = E[k] + W^k O[k], with E and O the spectra of the even and odd
+    // lags recovered from Z[k] and conj(Z[HALF - k]); then rotated to the
+    // zero-lag reference if there is one
+    void split(bool rotating)
+    {
+        for (int b = 0; b < numBaselines; b++) {
+            const float *zr = workr + (size_t)b * HALF;
+            const float *zi = worki + (size_t)b * HALF;
+            const float *cr = rotr + (size_t)b * STRIDE;
+            const float *ci = roti + (size_t)b * STRIDE;
+            float *xr = specr + (size_t)b * STRIDE;
+            float *xi = speci + (size_t)b * STRIDE;
+            // DC and Nyquist both come from Z[0]
+            xr[0] = zr[0] + zi[0];
+            xi[0] = 0.f;
+            xr[HALF] = rotating ? (zr[0] - zi[0]) * cr[HALF] : zr[0] - zi[0];
+            xi[HALF] = rotating ? (zr[0] - zi[0]) * ci[HALF] : 0.f;
+            int k = 1;
+#if defined(__SSE2__)
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; k + 4 <= HALF; k += 4) {
+                // Z[HALF - k] for the four k, reversed into the same order
+                __m128 z1r = _mm_loadu_ps(zr + k), z1i = _mm_loadu_ps(zi + k);
+                __m128 z2r = _mm_loadu_ps(zr + HALF - k - 3), z2i = _mm_loadu_ps(zi + HALF - k - 3);
+                z2r = _mm_shuffle_ps(z2r, z2r, _MM_SHUFFLE(0, 1, 2, 3));
+                z2i = _mm_shuffle_ps(z2i, z2i, _MM_SHUFFLE(0, 1, 2, 3));
+                __m128 er = _mm_mul_ps(half, _mm_add_ps(z1r, z2r)), ei = _mm_mul_ps(half, _mm_sub_ps(z1i, z2i));
+                __m128 or_ = _mm_mul_ps(half, _mm_add_ps(z1i, z2i)), oi = _mm_mul_ps(half, _mm_sub_ps(z2r, z1r));
+                __m128 wr = _mm_loadu_ps(splitr + k), wi = _mm_loadu_ps(spliti + k);
+                __m128 re = _mm_add_ps(er, _mm_sub_ps(_mm_mul_ps(wr, or_), _mm_mul_ps(wi, oi)));
+                __m128 im = _mm_add_ps(ei, _mm_add_ps(_mm_mul_ps(wr, oi), _mm_mul_ps(wi, or_)));
+                if (rotating) {
+                    __m128 vcr = _mm_loadu_ps(cr + k), vci = _mm_loadu_ps(ci + k);
+                    __m128 t = _mm_sub_ps(_mm_mul_ps(re, vcr), _mm_mul_ps(im, vci));
+                    im = _mm_add_ps(_mm_mul_ps(re, vci), _mm_mul_ps(im, vcr));
+                    re = t;
+                }
+                _mm_storeu_ps(xr + k, re);
+                _mm_storeu_ps(xi + k, im);
+            }
+#endif
+            for (; k < HALF; k++) {
+                int k2 = HALF - k;
+                float er = 0.5f * (zr[k] + zr[k2]), ei = 0.5f * (zi[k] - zi[k2]);
+                float or_ = 0.5f * (zi[k] + zi[k2]), oi = 0.5f * (zr[k2] - zr[k]);
+                float re = er + splitr[k] * or_ - spliti[k] * oi;
+                float im = ei + splitr[k] * oi + spliti[k] * or_;
+                if (rotating) {
+                    xr[k] = re * cr[k] - im * ci[k];
+                    xi[k] = re * ci[k] + im * cr[k];
+                } else {
+                    xr[k] = re;
+                    xi[k] = im;
+                }
+            }
+        }
+    }
+    // inverse of split() into conj(Z) for every set and baseline, then the
+    // forward stages: the conjugate of their output is HALF times the
+    // inverse FFT
+    void backward(float (*rows)[NUMLAGS], const float *gains, int numSets, bool phat)
+    {
+        int count = numSets * numBaselines;
+        reserveWork(count);
+        for (int b = 0; b < numBaselines; b++) {
+            const float *xr = specr + (size_t)b * STRIDE;
+            const float *xi = speci + (size_t)b * STRIDE;
+            const float *cr = rotr + (size_t)b * STRIDE;
+            const float *ci = roti + (size_t)b * STRIDE;
+            float floor = 0.f;
+            if (phat) {
+                for (int k = 1; k < BINS; k++) floor += sqrtf(xr[k] * xr[k] + xi[k] * xi[k]);
+                floor *= phatFloor / (BINS - 1);
+            }
+            for (int k = 0; k < BINS; k++) {
+                float re = xr[k], im = xi[k];
+                if (rotated) {
+                    re = xr[k] * cr[k] + xi[k] * ci[k];
+                    im = xi[k] * cr[k] - xr[k] * ci[k];
+                }
+                if (phat) {
+                    // nothing but the removed mean in DC
+                    float mag = sqrtf(re * re + im * im) + floor;
+                    float gain = (k == 0 || mag <= 0.f) ? 0.f : 1.f / mag;
+                    re *= gain;
+                    im *= gain;
+                }
+                binr[k] = re;
+                bini[k] = im;
+            }
+            for (int set = 0; set < numSets; set++) {
+                const float *g = gains ? gains + (size_t)set * BINS : NULL;
+                float *zr = workr + ((size_t)set * numBaselines + b) * HALF;
+                float *zi = worki + ((size_t)set * numBaselines + b) * HALF;
+                for (int k = 0; k < HALF; k++) {
+                    int k2 = HALF - k;
+                    float g1 = g ? g[k] : 1.f, g2 = g ? g[k2] : 1.f;
+                    float ar = g1 * binr[k], ai = g1 * bini[k], br = g2 * binr[k2], bi = g2 * bini[k2];
+                    // E = (X[k] + conj X[k2]) / 2, O = (X[k] - conj X[k2]) / 2 W^k
+                    float er = 0.5f * (ar + br), ei = 0.5f * (ai - bi);
+                    float dr = 0.5f * (ar - br), di = 0.5f * (ai + bi);
+                    float or_ = dr * splitr[k] + di * spliti[k], oi = di * splitr[k] - dr * spliti[k];
+                    // conj(E + i O)
+                    zr[reversed[k]] = er - oi;
+                    zi[reversed[k]] = -(ei + or_);
+                }
+            }
+        }
+        firstStages(count);
+        for (int h = 4; h < HALF; h *= 2) stage(h, count);
+        const float scale = 1.f / HALF;
+        for (int r = 0; r < count; r++) {
+            const float *zr = workr + (size_t)r * HALF;
+            const float *zi = worki + (size_t)r * HALF;
+            float *row = rows[r];
+            for (int n = 0; n < HALF; n++) {
+                row[2 * n] = zr[n] * scale;
+                row[2 * n + 1] = -zi[n] * scale;
+            }
+            for (int j = 0; j < 5; j++) row[j] = 0.f;
+        }
+    }
+    // factors exp(2 pi i k c / NUMLAGS) that move each row's zero lag c to
+    // bin 0; they only change with the lag offsets
+    void updateRotation(const float *centres)
+    {
+        bool same = (int)lastCentres.size() == numBaselines;
+        for (int b = 0; same && b < numBaselines; b++) same = lastCentres[b] == centres[b];
+        if (same) return;
+        lastCentres.assign(centres, centres + numBaselines);
+        for (int b = 0; b < numBaselines; b++) {
+            for (int k = 0; k < BINS; k++) {
+                double a = 2. * M_PI * k * centres[b] / NUMLAGS;
+                rotr[(size_t)b * STRIDE + k] = cos(a);
+                roti[(size_t)b * STRIDE + k] = sin(a);
+            }
+        }
+    }
+};
+
+#endif
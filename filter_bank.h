@@ -0,0 +1,90 @@
+#ifndef FILTER_BANK_H
+#define FILTER_BANK_H
+
+#include "fft.h"
+
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+// Splits the lag rows into frequency bands, so sources that live in
+// different bands can be imaged apart (or each band normalised on its own
+// before the bands are combined).
+//
+// A band is a gain per cross-power spectrum bin: one inside [low, high],
+// zero outside, with raised-cosine edges one bin wide on either side. Where
+// one band ends and the next begins the two edges add up to one, so
+// adjacent bands sum back to the broadband row. All bands come back from the
+// spectra in one batched inverse (LagSpectra::filter), band-major: rows
+// [band * baselines + baseline], so the cost goes with the number of bands.
+
+class LagFilterBank
+{
+public:
+    static const int MAXBANDS = 8;
+
+    LagFilterBank() {}
+
+    // band edges in Hz, {low, high} each; bands that are empty at this
+    // sample rate are dropped
+    // ------------------------------------------------------------------------
+    void setBands(const std::vector<std::vector<float> > &edges, float sampleRate)
+    {
+        lows.clear();
+        highs.clear();
+        gains.clear();
+        float binWidth = sampleRate / NUMLAGS;
+        for (size_t i = 0; i < edges.size() && (int)lows.size() < MAXBANDS; i++) {
+            if (edges[i].size() != 2 || edges[i][1] <= edges[i][0] || edges[i][0] >= sampleRate / 2) {
+                std::cout << "Skipping band " << i + 1 << ": needs {low, high} in Hz below " << sampleRate / 2 << std::endl;
+                continue;
+            }
+            lows.push_back(edges[i][0]);
+            highs.push_back(edges[i][1]);
+            // no edge at 0 Hz or at Nyquist, where the spectrum ends anyway
+            bool fromZero = edges[i][0] <= 0.f, toNyquist = edges[i][1] >= sampleRate / 2;
+            for (int k = 0; k < LagSpectra::BINS; k++) {
+                float f = k * binWidth;
+                float g = fromZero ? 1.f : edge(f, edges[i][0], binWidth);
+                if (!toNyquist) g *= 1.f - edge(f, edges[i][1], binWidth);
+                gains.push_back(g);
+            }
+        }
+    }
+    // ------------------------------------------------------------------------
+    int numBands() const
+    {
+        return lows.size();
+    }
+    // ------------------------------------------------------------------------
+    float low(int band) const
+    {
+        return lows[band];
+    }
+    float high(int band) const
+    {
+        return highs[band];
+    }
+    // lag rows of every band from the spectra of the last transform,
+    // rows[band * baselines + baseline]; whitened first if phat
+    // ------------------------------------------------------------------------
+    void run(LagSpectra &spectra, float (*rows)[NUMLAGS], bool phat) const
+    {
+        if (lows.empty()) return;
+        spectra.filter(rows, &gains[0], numBands(), phat);
+    }
+
+private:
+    std::vector<float> lows, highs;
+    std::vector<float> gains;       // [band][LagSpectra::BINS]
+
+    // 0 below f0, 1 above, raised cosine over one bin either side
+    static float edge(float f, float f0, float width)
+    {
+        if (f <= f0 - width) return 0.f;
+        if (f >= f0 + width) return 1.f;
+        return 0.5f - 0.5f * cosf(M_PI * (f - f0 + width) / (2.f * width));
+    }
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef FRAME_TIMER_H
+#define FRAME_TIMER_H
+
+#include "glad.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+// Where the frame time goes, per stage, on both sides:
+//
+//   GPU passes are wrapped in GL_TIME_ELAPSED queries. Each pass has a small
+//   ring of query objects; collect() reads back the finished ones in order
+//   and never waits, so results arrive a frame or two late. If the ring is
+//   full (the GPU is that far behind) the frame is simply not timed.
+//   CPU stages are timed with a steady clock.
+//
+// The last 'window' samples of every stage are kept and report() prints
+// their percentiles. Timer queries cannot nest, so GPU passes must not
+// overlap; CPU stages may.
+//
+// Drivers without a timer counter (no GL_QUERY_COUNTER_BITS) only get CPU
+// numbers. Mesa's llvmpipe does have one, but it runs draws when they are
+// flushed, so there the GPU numbers are closer to submission times.
+
+class FrameTimer
+{
+public:
+    bool gpuTiming;
+
+    FrameTimer(int windowSize = 240) : gpuTiming(true), window(windowSize)
+    {
+        GLint bits = 0;
+        glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+        gpuTiming = bits > 0;
+        if (!gpuTiming) std::cout << "No GPU timer available, timing CPU stages only" << std::endl;
+    }
+    // ------------------------------------------------------------------------
+    int addGpuPass(const std::string &name)
+    {
+        return addStage(name, true);
+    }
+    // ------------------------------------------------------------------------
+    int addCpuStage(const std::string &name)
+    {
+        return addStage(name, false);
+    }
+    // ------------------------------------------------------------------------
+    void begin(int id)
+    {
+        Stage &s = stages[id];
+        if (!s.gpu) {
+            s.start = std::chrono::steady_clock::now();
+            return;
+        }
+        s.timing = gpuTiming && s.inFlight < RING;
+        if (!s.timing) return;
+        glBeginQuery(GL_TIME_ELAPSED, s.queries[(s.oldest + s.inFlight) % RING]);
+    }
+    // ------------------------------------------------------------------------
+    void end(int id)
+    {
+        Stage &s = stages[id];
+        if (!s.gpu) {
+            std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+            addSample(s, std::chrono::duration<float, std::milli>(t - s.start).count());
+            return;
+        }
+        if (!s.timing) return;
+        glEndQuery(GL_TIME_ELAPSED);
+        s.inFlight++;
+    }
+    // read back finished GPU timings without waiting; call once per frame
+    // before looking at latest()
+    // ------------------------------------------------------------------------
+    void collect()
+    {
+        for (size_t i = 0; i < stages.size(); i++) {
+            Stage &s = stages[i];
+            if (!s.gpu) continue;
+            s.fresh.clear();
+            while (s.inFlight > 0) {
+                GLint available = 0;
+                glGetQueryObjectiv(s.queries[s.oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) break;
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(s.queries[s.oldest], GL_QUERY_RESULT, &ns);
+                s.oldest = (s.oldest + 1) % RING;
+                s.inFlight--;
+                // llvmpipe can hand back a clock reading instead of an
+                // interval for the first query of a pass
+                if (ns > 10000000000ULL) continue;
+                addSample(s, ns / 1e6f);
+            }
+        }
+    }
+    // GPU timings (ms) that came in with the last collect(), oldest first
+    // ------------------------------------------------------------------------
+    const std::vector<float> &latest(int id) const
+    {
+        return stages[id].fresh;
+    }
+    // percentiles of every stage over the last 'window' samples
+    // ------------------------------------------------------------------------
+    void report() const
+    {
+        std::cout << "Stage timings (ms)        p50      p90      p99      max  samples" << std::endl;
+        for (size_t i = 0; i < stages.size(); i++) {
+            const Stage &s = stages[i];
+            std::cout << "  " << std::left << std::setw(22) << s.name + (s.gpu ? " (GPU)" : " (CPU)") << std::right;
+            if (s.samples.empty()) {
+                std::cout << "        -" << std::endl;
+                continue;
+            }
+            std::vector<float> sorted(s.samples.begin(), s.samples.end());
+            std::sort(sorted.begin(), sorted.end());
+            std::cout << std::fixed << std::setprecision(3)
+                      << std::setw(9) << percentile(sorted, 0.5) << std::setw(9) << percentile(sorted, 0.9)
+                      << std::setw(9) << percentile(sorted, 0.99) << std::setw(9) << sorted.back()
+                      << std::setw(9) << sorted.size() << std::defaultfloat << std::endl;
+        }
+    }
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        for (size_t i = 0; i < stages.size(); i++) {
+            if (stages[i].gpu) glDeleteQueries(RING, stages[i].queries);
+        }
+    }
+
+private:
+    static const int RING = 4;
+
+    struct Stage
+    {
+        std::string name;
+        bool gpu;
+        unsigned int queries[RING];
+        int oldest, inFlight;
+        bool timing;
+        std::chrono::steady_clock::time_point start;
+        std::deque<float> samples;
+        std::vector<float> fresh;
+    };
+    std::vector<Stage> stages;
+    size_t window;
+
+    int addStage(const std::string &name, bool gpu)
+    {
+        stages.push_back(Stage());
+        Stage &s = stages.back();
+        s.name = name;
+        s.gpu = gpu;
+        s.oldest = 0;
+        s.inFlight = 0;
+        s.timing = false;
+        if (gpu) glGenQueries(RING, s.queries);
+        return stages.size() - 1;
+    }
+    void addSample(Stage &s, float ms)
+    {
+        s.samples.push_back(ms);
+        if (s.samples.size() > window) s.samples.pop_front();
+        if (s.gpu) s.fresh.push_back(ms);
+    }
+    static float percentile(const std::vector<float> &sorted, float p)
+    {
+        return sorted[(size_t)(p * (sorted.size() - 1) + 0.5f)];
+    }
+};
+
+#endif
@@ -3,8 +3,11 @@
 // - Storing bit-range selected audio samples in BRAM for each mic
 // - Feeding audio samples from each mic BRAM into baseline-based lag
 // correlators
+// - Accumulating the zero-lag auto-correlation (power) of each mic over the
+// same integration period
 // - After integration, feeding the correlation products into a transfer
-// manager for transmission over ethernet.
+// manager for transmission over ethernet, preceded by one packet with the
+// sample count and the sum and power of every mic.
 
 // NOTE: Fix the mic clk in wiring! We only have one clk pin now, so we will
 // have to split it over all mics in wiring.
@@ -125,6 +128,17 @@ for (i = 0; i < NUMBASELINES; i++) begin
   assign lag_data_all[(i+1) * 32 - 1 : i * 32] = lag_data_out[i];
 end
 
+// Per-mic sample sums and powers, two words per mic on one bus as well
+wire [31:0] power_sum_out [NUMMICS - 1 : 0];
+wire [31:0] power_out [NUMMICS - 1 : 0];
+wire [31:0] power_count;
+wire [NUMMICS * 64 - 1 : 0] power_data_all;
+
+for (i = 0; i < NUMMICS; i++) begin
+  assign power_data_all[i * 64 + 31 : i * 64] = power_sum_out[i];
+  assign power_data_all[i * 64 + 63 : i * 64 + 32] = power_out[i];
+end
+
 wire export_flag;
 wire serial_data;
 
@@ -209,9 +223,33 @@ for (i = 0; i < (NUMMICS - 1); i++) begin
   end
 end
 
+// Power managers, 1 per mic, integrating in step with the lag managers. Only
+// the first gives the sample count.
+for (i = 0; i < NUMMICS; i++) begin
+  if (i == 0) begin
+    powermanager power (.d_in(CIC_to_samplemanager[i]),
+                        .clk_in(clk_100MHz),
+                        .sample_ready(load_data),
+                        .export_active(export_flag),
+                        .sum_out(power_sum_out[i]),
+                        .power_out(power_out[i]),
+                        .count_out(power_count));
+  end else begin
+    powermanager power (.d_in(CIC_to_samplemanager[i]),
+                        .clk_in(clk_100MHz),
+                        .sample_ready(load_data),
+                        .export_active(export_flag),
+                        .sum_out(power_sum_out[i]),
+                        .power_out(power_out[i]),
+                        .count_out());
+  end
+end
+
 // Transfer manager. Use a parametrized width data bus for input, scaling with
 // number of mics.
-transfermanager #(.numlags(NUMLAGS), .numbaselines(NUMBASELINES)) transfer (.d_in_all(lag_data_all),
+transfermanager #(.numlags(NUMLAGS), .numbaselines(NUMBASELINES), .nummics(NUMMICS)) transfer (.d_in_all(lag_data_all),
+                                                                            .d_in_power(power_data_all),
+                                                                            .power_count(power_count),
                                                                             .clk_in(clk_100MHz),
                                                                             .clk_in_2(clk_100MHz),
                                                                             .export_active(export_flag),
@@ -544,6 +582,62 @@ end
 
 endmodule
 
+// The power manager accumulates the zero-lag auto-correlation of one mic: the
+// sum of its samples and the sum of their squares, over the same samples as
+// the lag managers integrate (from just after one export up to and including
+// the sample that triggers the next). Both are latched, with the sample
+// count, on the rising edge of export_active and held until the next one, so
+// the transfer manager can send them ahead of the baseline packets of the
+// same integration period. The sum of squares is saturated at 32 bits rather
+// than wrapped, so an overloaded mic shows up as such.
+module powermanager (input wire signed [17:0] d_in,
+                     input wire clk_in,
+                     input wire sample_ready,
+                     input wire export_active,
+                     output reg signed [31:0] sum_out,
+                     output reg [31:0] power_out,
+                     output reg [31:0] count_out);
+
+reg signed [31:0] sum;
+reg [47:0] power;
+reg [31:0] count;
+reg sample_ready_last;
+reg export_last;
+
+wire signed [35:0] square = d_in * d_in;
+
+initial begin
+  sum = 0;
+  power = 0;
+  count = 0;
+  sum_out = 0;
+  power_out = 0;
+  count_out = 0;
+  sample_ready_last = 1;
+  export_last = 0;
+end
+
+always @(posedge clk_in) begin
+  sample_ready_last <= sample_ready;
+  export_last <= export_active;
+  if (export_active == 1 && export_last == 0) begin
+    // End of an integration period: hand over the totals and start again
+    sum_out <= sum;
+    power_out <= (power[47:32] != 0) ? 32'hFFFFFFFF : power[31:0];
+    count_out <= count;
+    sum <= 0;
+    power <= 0;
+    count <= 0;
+  end else if (sample_ready == 0 && sample_ready_last == 1) begin
+    // A new sample from the CIC filter (load goes low for one 3 MHz cycle)
+    sum <= sum + d_in;
+    power <= power + square;
+    count <= count + 1;
+  end
+end
+
+endmodule
+
 // TODO: Include a UDP transfer block in this transfermanager, working in
 // parallel to the serial output. It will have to run at a different clock
 // speed though, so I may only be able to have one of them active at a time as
@@ -559,8 +653,11 @@ endmodule
 // available for other frame components to be added in between UDP payloads).
 
 module transfermanager #(parameter numlags = 256,
-                         parameter numbaselines = 15)
+                         parameter numbaselines = 15,
+                         parameter nummics = 6)
                        (input wire signed [32 * numbaselines - 1: 0 ] d_in_all,
+                        input wire [64 * nummics - 1 : 0] d_in_power,
+                        input wire [31:0] power_count,
                         input wire clk_in,
                         input wire clk_in_2,
                         input wire export_active,
@@ -587,6 +684,7 @@ reg transfer_state;
 reg transfer_complete;
 reg [$clog2(numlags) + 4:0] lag_idx;
 reg [7:0] baseline; // We use 8 bits for simplicity when transferring the dummy code
+reg power_packet;   // the packet being sent is the mic power packet
 
 initial begin
   // Set all params to their initial values here
@@ -604,6 +702,7 @@ initial begin
 
   lag_idx = 0;
   baseline = 0;
+  power_packet = 1;
 end
 
 generate
@@ -618,6 +717,9 @@ endgenerate
 // a row
 // - Once this is complete, switch to transmission mode and start outputting
 // packets using the data clock.
+// - Before the first baseline, send one packet marked 0xFEFEFEFE with the
+// per-mic words from the power managers (latched at the start of this export,
+// so they cover the same samples as the lags that follow).
 // - Once finished, go back to sleep and wait for the next export_active flag.
 
 always @(posedge clk_in) begin
@@ -650,6 +752,12 @@ end
 // We need to interface with the UDP core, so first thing is to add an
 // instantiation of that module here.
 
+// Power packet: word 1 is the sample count, words 2 + 2m and 3 + 2m the sample
+// sum and power of mic m, the rest zero
+wire [31:0] power_word = (lag_idx == 1) ? power_count :
+                         (lag_idx >= 2 && lag_idx < 2 + 2 * nummics) ? d_in_power[32 * (lag_idx - 2) +: 32] :
+                         32'h00000000;
+
 reg [31:0] data_to_send = 32'h00000000;
 reg data_valid = 0;
 reg data_last = 0;
@@ -670,7 +778,7 @@ always @ (posedge clk_in_2) begin
   if (transfer_state == 1 && transfer_complete == 0) begin
     if (lag_idx == 0) begin
       // Send dummy byte sequence
-      data_to_send <= {4{baseline}};
+      data_to_send <= power_packet ? {4{8'hFE}} : {4{baseline}};
       data_valid <= 1;
       data_last <= 0;
       address_read <= 0; // Prepare address for lag values next cycle
@@ -679,14 +787,14 @@ always @ (posedge clk_in_2) begin
       // Regular transmission
       data_valid <= 1;
       data_last <= 0;
-      data_to_send <= read_data[baseline];
+      data_to_send <= power_packet ? power_word : read_data[baseline];
       address_read <= address_read + 1;
       lag_idx <= lag_idx + 1;
     end else if (lag_idx == (numlags - 1)) begin
       // end transmission, de-activate data input for PHY
       data_valid <= 1;
       data_last <= 1;
-      data_to_send <= read_data[baseline];
+      data_to_send <= power_packet ? power_word : read_data[baseline];
       lag_idx <= lag_idx + 1;
       address_read <= 0;
     end else if (lag_idx == numlags) begin
@@ -702,13 +810,19 @@ always @ (posedge clk_in_2) begin
       lag_idx <= lag_idx + 1;
     end else if (lag_idx == (10 * numlags)) begin
       lag_idx <= 0;
-      if (baseline < (numbaselines - 1)) begin
+      if (power_packet == 1) begin
+        // Power packet sent, on to the first baseline
+        power_packet <= 0;
+        baseline <= 0;
+      end else if (baseline < numbaselines - 1) begin
 	// Go to next baseline
         baseline <= baseline + 1;
       end else begin
-        // End transmission after having completed the last packet sent
+        // End transmission after having completed the last packet sent; the
+        // next one starts with the power packet again
         transfer_complete <= 1;
         baseline <= 0;
+        power_packet <= 1;
       end
     end
   end else if (transfer_complete == 1) begin
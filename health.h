@@ -0,0 +1,186 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include "array_geometry.h"
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+// Watches the decoded lag rows for signs of a dead, stuck or saturated mic,
+// which otherwise only show up as odd artefacts in the map. Per dump, at
+// O(NUMLAGS) (a pass for min/max and a hash of the row), a row counts as
+//
+//   zero           all bins 5 .. NUMLAGS - 1 are 0 (empty packet)
+//   flat           all those bins are equal
+//   stuck          bit-identical to the previous stuckRows - 1 rows
+//   low/high var.  variance more than varianceRatio below/above the median
+//                  variance of all baselines (from the last evaluate())
+//
+// A baseline turns anomalous after badRows anomalous rows in a row and
+// recovers after goodRows clean ones. Every mic touches numMics - 1
+// baselines; when more than half of them are anomalous the mic is blamed.
+// With autoMask, the baselines of blamed mics and anomalous baselines are
+// masked out of imaging.
+
+enum HealthState { HEALTH_OK, HEALTH_ZERO, HEALTH_FLAT, HEALTH_STUCK, HEALTH_LOW_VARIANCE, HEALTH_HIGH_VARIANCE, HEALTH_STATES };
+
+class ArrayHealth
+{
+public:
+    bool autoMask;
+    float varianceRatio;
+    int stuckRows, badRows, goodRows;
+
+    std::vector<int> baselineState;     // HealthState
+    std::vector<int> micState;
+    std::vector<char> masked;           // baseline left out of imaging
+
+    ArrayHealth() : autoMask(true), varianceRatio(100.f), stuckRows(3), badRows(3), goodRows(10),
+                    numMics(0), numBaselines(0), medianVariance(0.f) {}
+
+    // ------------------------------------------------------------------------
+    void setGeometry(const ArrayGeometry &geom)
+    {
+        numMics = geom.numMics;
+        numBaselines = geom.numBaselines;
+        baselineMics.assign(geom.baselineMics[0], geom.baselineMics[0] + 2 * numBaselines);
+        baselineState.assign(numBaselines, HEALTH_OK);
+        micState.assign(numMics, HEALTH_OK);
+        masked.assign(numBaselines, 0);
+        variance.assign(numBaselines, 0.f);
+        lastHash.assign(numBaselines, 0);
+        repeats.assign(numBaselines, 0);
+        bad.assign(numBaselines, 0);
+        good.assign(numBaselines, 0);
+        rowState.assign(numBaselines, HEALTH_OK);
+        lastBaselineState = baselineState;
+        medianVariance = 0.f;
+    }
+    // ------------------------------------------------------------------------
+    int micCount() const
+    {
+        return numMics;
+    }
+    // a decoded row of baseline b, with its variance over bins 5 ..
+    // ------------------------------------------------------------------------
+    void check(int b, const float *row, float rowVariance)
+    {
+        variance[b] = rowVariance;
+        float lo = row[5], hi = row[5];
+        unsigned long long hash = 14695981039346656037ULL;
+        for (int j = 5; j < NUMLAGS; j++) {
+            lo = std::min(lo, row[j]);
+            hi = std::max(hi, row[j]);
+            unsigned int bits;
+            memcpy(&bits, &row[j], sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ULL;
+        }
+        repeats[b] = hash == lastHash[b] ? repeats[b] + 1 : 0;
+        lastHash[b] = hash;
+
+        int state = HEALTH_OK;
+        if (lo == 0.f && hi == 0.f) state = HEALTH_ZERO;
+        else if (lo == hi) state = HEALTH_FLAT;
+        else if (repeats[b] >= stuckRows - 1) state = HEALTH_STUCK;
+        else if (medianVariance > 0.f && rowVariance < medianVariance / varianceRatio) state = HEALTH_LOW_VARIANCE;
+        else if (medianVariance > 0.f && rowVariance > medianVariance * varianceRatio) state = HEALTH_HIGH_VARIANCE;
+        rowState[b] = state;
+
+        if (state != HEALTH_OK) {
+            good[b] = 0;
+            if (++bad[b] >= badRows) baselineState[b] = state;
+        } else {
+            bad[b] = 0;
+            if (++good[b] >= goodRows) baselineState[b] = HEALTH_OK;
+        }
+    }
+    // once per frame: update the variance reference, blame mics and mask
+    // baselines; true if any state changed
+    // ------------------------------------------------------------------------
+    bool evaluate()
+    {
+        // reference variance from the rows that carry something
+        scratch.clear();
+        for (int b = 0; b < numBaselines; b++) {
+            if (rowState[b] != HEALTH_ZERO && rowState[b] != HEALTH_FLAT && variance[b] > 0.f) scratch.push_back(variance[b]);
+        }
+        if (!scratch.empty()) {
+            std::nth_element(scratch.begin(), scratch.begin() + scratch.size() / 2, scratch.end());
+            medianVariance = scratch[scratch.size() / 2];
+        }
+
+        bool changed = baselineState != lastBaselineState;
+        lastBaselineState = baselineState;
+        for (int m = 0; m < numMics; m++) {
+            int counts[HEALTH_STATES] = {0};
+            for (int b = 0; b < numBaselines; b++) {
+                if (baselineMics[2 * b] == m || baselineMics[2 * b + 1] == m) counts[baselineState[b]]++;
+            }
+            int state = HEALTH_OK;
+            int anomalous = numMics - 1 - counts[HEALTH_OK];
+            if (anomalous >= 2 && 2 * anomalous > numMics - 1) {
+                state = HEALTH_ZERO;
+                for (int s = HEALTH_ZERO; s < HEALTH_STATES; s++) if (counts[s] > counts[state]) state = s;
+            }
+            if (state != micState[m]) changed = true;
+            micState[m] = state;
+        }
+        for (int b = 0; b < numBaselines; b++) {
+            char mask = autoMask && (baselineState[b] != HEALTH_OK || micState[baselineMics[2 * b]] != HEALTH_OK ||
+                                     micState[baselineMics[2 * b + 1]] != HEALTH_OK);
+            if (mask != masked[b]) changed = true;
+            masked[b] = mask;
+        }
+        return changed;
+    }
+    // ------------------------------------------------------------------------
+    int numMasked() const
+    {
+        int count = 0;
+        for (int b = 0; b < numBaselines; b++) count += masked[b];
+        return count;
+    }
+    // ------------------------------------------------------------------------
+    static const char *name(int state)
+    {
+        static const char *names[HEALTH_STATES] = {"ok", "zero", "flat", "stuck", "low variance", "high variance"};
+        return names[state];
+    }
+    // print the mics and baselines that are not ok
+    // ------------------------------------------------------------------------
+    void report() const
+    {
+        std::cout << "Health: ";
+        int count = 0;
+        for (int m = 0; m < numMics; m++) {
+            if (micState[m] == HEALTH_OK) continue;
+            std::cout << (count++ ? ", " : "") << "mic " << m + 1 << " " << name(micState[m]);
+        }
+        for (int b = 0; b < numBaselines; b++) {
+            if (baselineState[b] == HEALTH_OK) continue;
+            int m1 = baselineMics[2 * b], m2 = baselineMics[2 * b + 1];
+            // already covered by a blamed mic
+            if (micState[m1] != HEALTH_OK || micState[m2] != HEALTH_OK) continue;
+            std::cout << (count++ ? ", " : "") << "baseline " << b << " (mics " << m1 + 1 << "-" << m2 + 1 << ") "
+                      << name(baselineState[b]);
+        }
+        if (count == 0) std::cout << "all mics ok";
+        std::cout << "; " << numMasked() << " baselines masked" << std::endl;
+    }
+
+private:
+    int numMics, numBaselines;
+    std::vector<int> baselineMics;          // [baseline][2]
+    std::vector<float> variance;            // of the last row
+    std::vector<unsigned long long> lastHash;
+    std::vector<int> repeats;               // identical rows since the last change
+    std::vector<int> bad, good;             // anomalous / clean rows in a row
+    std::vector<int> rowState;              // of the last row
+    std::vector<int> lastBaselineState;     // as of the last evaluate()
+    std::vector<float> scratch;
+    float medianVariance;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <vector>
+#include <cmath>
+
+// Client-side integration of the decoded lag rows over several sliding
+// windows at once (say 50 ms, 500 ms and 5 s), so the integration time can
+// be picked on the client instead of in the bitstream, and the map no longer
+// has to wait for the next dump.
+//
+// Each window is cut into SLOTS time slots of window / SLOTS. Per window and
+// baseline there is a ring of slot sums and one running sum over the ring:
+// a new dump is added to the current slot and the running sum, and when a
+// slot falls out of the window it is subtracted from the running sum and
+// reused. Both are O(NUMLAGS) per dump or slot, whatever the window length
+// and dump rate. The window edge moves in whole slots, so a window covers
+// between (SLOTS - 1) / SLOTS and all of its nominal length.
+//
+// Sums are kept in double so adding and later subtracting the same dumps
+// does not drift.
+
+#ifndef NUMLAGS
+#define NUMLAGS 256
+#endif
+
+class LagIntegrator
+{
+public:
+    static const int SLOTS = 10;
+
+    LagIntegrator() : numBaselines(0) {}
+
+    // windows in seconds; drops everything integrated so far
+    // ------------------------------------------------------------------------
+    void setWindows(const std::vector<float> &seconds, int baselines)
+    {
+        numBaselines = baselines;
+        windows.assign(seconds.size(), Window());
+        for (size_t w = 0; w < windows.size(); w++) {
+            Window &win = windows[w];
+            win.length = seconds[w];
+            win.slotLength = seconds[w] / SLOTS;
+            win.slot = -1;
+            win.slots.assign((size_t)numBaselines * SLOTS * NUMLAGS, 0.);
+            win.slotCounts.assign((size_t)numBaselines * SLOTS, 0);
+            win.sums.assign((size_t)numBaselines * NUMLAGS, 0.);
+            win.counts.assign(numBaselines, 0);
+            win.dirty.assign(numBaselines, 1);
+        }
+    }
+    // ------------------------------------------------------------------------
+    int numWindows() const
+    {
+        return windows.size();
+    }
+    // ------------------------------------------------------------------------
+    float windowLength(int w) const
+    {
+        return windows[w].length;
+    }
+    // move all windows on to time t (seconds), expiring old slots
+    // ------------------------------------------------------------------------
+    void advance(double t)
+    {
+        for (size_t w = 0; w < windows.size(); w++) {
+            Window &win = windows[w];
+            long long slot = (long long)floor(t / win.slotLength);
+            // start (or restart after a gap) with a full ring of empty slots,
+            // but never before slot 0: the ring index must not go negative
+            if (win.slot < 0 || slot - win.slot > SLOTS) win.slot = slot > SLOTS ? slot - SLOTS : 0;
+            while (win.slot < slot) {
+                win.slot++;
+                int s = (int)(win.slot % SLOTS);
+                for (int b = 0; b < numBaselines; b++) expire(win, b, s);
+            }
+        }
+    }
+    // a decoded dump of baseline b at time t (seconds)
+    // ------------------------------------------------------------------------
+    void add(int b, const float *lags, double t)
+    {
+        advance(t);
+        for (size_t w = 0; w < windows.size(); w++) {
+            Window &win = windows[w];
+            int s = (int)(win.slot % SLOTS);
+            double *slot = &win.slots[((size_t)b * SLOTS + s) * NUMLAGS];
+            double *sum = &win.sums[(size_t)b * NUMLAGS];
+            for (int j = 0; j < NUMLAGS; j++) {
+                slot[j] += lags[j];
+                sum[j] += lags[j];
+            }
+            win.slotCounts[(size_t)b * SLOTS + s]++;
+            win.counts[b]++;
+            win.dirty[b] = 1;
+        }
+    }
+    // dumps of baseline b in window w
+    // ------------------------------------------------------------------------
+    int frames(int w, int b) const
+    {
+        return windows[w].counts[b];
+    }
+    // true once after the mean of baseline b in window w changed
+    // ------------------------------------------------------------------------
+    bool takeChanged(int w, int b)
+    {
+        bool changed = windows[w].dirty[b];
+        windows[w].dirty[b] = 0;
+        return changed;
+    }
+    // mark every row of window w as changed, e.g. when it gets selected
+    // ------------------------------------------------------------------------
+    void touch(int w)
+    {
+        windows[w].dirty.assign(numBaselines, 1);
+    }
+    // mean lag row of baseline b over window w; false (and out untouched)
+    // if the window holds no dumps
+    // ------------------------------------------------------------------------
+    bool mean(int w, int b, float *out) const
+    {
+        const Window &win = windows[w];
+        int n = win.counts[b];
+        if (n == 0) return false;
+        const double *sum = &win.sums[(size_t)b * NUMLAGS];
+        for (int j = 0; j < NUMLAGS; j++) out[j] = sum[j] / n;
+        return true;
+    }
+
+private:
+    struct Window
+    {
+        float length, slotLength;
+        long long slot;                 // current slot, counted from t = 0
+        std::vector<double> slots;      // [baseline][slot][lag]
+        std::vector<int> slotCounts;    // [baseline][slot]
+        std::vector<double> sums;       // [baseline][lag]
+        std::vector<int> counts;        // [baseline]
+        std::vector<char> dirty;        // [baseline]
+    };
+    std::vector<Window> windows;
+    int numBaselines;
+
+    // take slot s of baseline b out of the running sum and empty it
+    void expire(Window &win, int b, int s)
+    {
+        int &n = win.slotCounts[(size_t)b * SLOTS + s];
+        if (n == 0) return;
+        double *slot = &win.slots[((size_t)b * SLOTS + s) * NUMLAGS];
+        double *sum = &win.sums[(size_t)b * NUMLAGS];
+        for (int j = 0; j < NUMLAGS; j++) {
+            sum[j] -= slot[j];
+            slot[j] = 0.;
+        }
+        win.counts[b] -= n;
+        n = 0;
+        if (win.counts[b] == 0) {
+            // nothing left: clear rounding residue
+            for (int j = 0; j < NUMLAGS; j++) sum[j] = 0.;
+        }
+        win.dirty[b] = 1;
+    }
+};
+
+#endif
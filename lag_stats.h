@@ -0,0 +1,155 @@
+#ifndef LAG_STATS_H
+#define LAG_STATS_H
+
+#include "array_geometry.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Per-baseline statistics of the lag rows, updated as each row comes in, in
+// O(NUMLAGS) per row. They replace fixed display ranges, which only suited
+// one room and one gain:
+//
+//   mean, variance  over bins 5 .. NUMLAGS - 1, by Welford's update in four
+//                   SSE2 lanes merged at the end (rows sit on a large
+//                   offset, so the naive sum of squares loses everything)
+//   floor, noise    median and 1.4826 x median absolute deviation: the level
+//                   and spread of the row without its peaks. Both are
+//                   smoothed over rows (smoothing = weight of the new row)
+//   peak, SNR       highest bin, and its height above the floor in noise
+//
+// From these come the display range of each row (floor up to the peak, but
+// never less than displaySigmas noise, so a row with nothing in it is not
+// stretched to full scale) and a quality flag: SNR above snrGood sets it,
+// below 3/4 of that clears it, so it does not flicker.
+
+class LagStatistics
+{
+public:
+    float smoothing;        // weight of a new row in floor and noise, 1: none
+    float displaySigmas;    // smallest display range, in noise
+    float snrGood;          // SNR that flags a baseline as having signal
+
+    // per baseline
+    std::vector<float> mean, variance, floor, noise, peak, snr;
+    std::vector<int> peakBin;
+    std::vector<char> good;
+    std::vector<float> low, span;   // display: (value - low) / span
+
+    LagStatistics(float rowSmoothing = 0.2f)
+        : smoothing(rowSmoothing), displaySigmas(10.f), snrGood(6.f), numBaselines(0) {}
+
+    // ------------------------------------------------------------------------
+    void setBaselines(int baselines)
+    {
+        numBaselines = baselines;
+        mean.assign(baselines, 0.f);
+        variance.assign(baselines, 0.f);
+        floor.assign(baselines, 0.f);
+        noise.assign(baselines, 0.f);
+        peak.assign(baselines, 0.f);
+        snr.assign(baselines, 0.f);
+        peakBin.assign(baselines, NUMLAGS / 2);
+        good.assign(baselines, 0);
+        low.assign(baselines, 0.f);
+        span.assign(baselines, 1.f);
+        rows.assign(baselines, 0);
+    }
+    // a new row for baseline b
+    // ------------------------------------------------------------------------
+    void update(int b, const float *row)
+    {
+        const float *x = row + 5;
+        const int n = NUMLAGS - 5;
+        welford(x, n, mean[b], variance[b]);
+
+        int bin = 0;
+        for (int j = 1; j < n; j++) if (x[j] > x[bin]) bin = j;
+        peak[b] = x[bin];
+        peakBin[b] = bin + 5;
+
+        for (int j = 0; j < n; j++) scratch[j] = x[j];
+        std::nth_element(scratch, scratch + n / 2, scratch + n);
+        float median = scratch[n / 2];
+        for (int j = 0; j < n; j++) scratch[j] = fabsf(x[j] - median);
+        std::nth_element(scratch, scratch + n / 2, scratch + n);
+        float sigma = 1.4826f * scratch[n / 2];
+
+        float a = rows[b] == 0 ? 1.f : smoothing;
+        floor[b] += a * (median - floor[b]);
+        noise[b] += a * (sigma - noise[b]);
+        rows[b]++;
+
+        snr[b] = noise[b] > 0.f ? (peak[b] - floor[b]) / noise[b] : 0.f;
+        if (snr[b] >= snrGood) good[b] = 1;
+        else if (snr[b] < 0.75f * snrGood) good[b] = 0;
+
+        low[b] = floor[b];
+        span[b] = std::max(peak[b] - floor[b], displaySigmas * noise[b]);
+        if (!(span[b] > 0.f)) span[b] = 1.f;
+    }
+    // baselines flagged as having signal
+    // ------------------------------------------------------------------------
+    int numGood() const
+    {
+        int count = 0;
+        for (int b = 0; b < numBaselines; b++) count += good[b];
+        return count;
+    }
+
+private:
+    int numBaselines;
+    std::vector<long> rows;         // rows seen per baseline
+    float scratch[NUMLAGS];
+
+    // mean and (population) variance of x[0 .. n - 1]
+    static void welford(const float *x, int n, float &outMean, float &outVariance)
+    {
+        double m = 0., m2 = 0.;
+        long count = 0;
+        int j = 0;
+#if defined(__SSE2__)
+        if (n >= 8) {
+            // four interleaved runs over the row, merged pairwise (Chan et
+            // al.), taken relative to x[0] to keep the float lanes precise
+            __m128 shift = _mm_set1_ps(x[0]);
+            __m128 vm = _mm_sub_ps(_mm_loadu_ps(x), shift), vm2 = _mm_setzero_ps();
+            int k = 1;
+            for (j = 4; j + 4 <= n; j += 4, k++) {
+                __m128 v = _mm_sub_ps(_mm_loadu_ps(x + j), shift);
+                __m128 delta = _mm_sub_ps(v, vm);
+                vm = _mm_add_ps(vm, _mm_mul_ps(delta, _mm_set1_ps(1.f / (k + 1))));
+                vm2 = _mm_add_ps(vm2, _mm_mul_ps(delta, _mm_sub_ps(v, vm)));
+            }
+            float lm[4], lm2[4];
+            _mm_storeu_ps(lm, vm);
+            _mm_storeu_ps(lm2, vm2);
+            for (int lane = 0; lane < 4; lane++) merge(m, m2, count, lm[lane] + (double)x[0], lm2[lane], k);
+        }
+#endif
+        for (; j < n; j++) {
+            count++;
+            double delta = x[j] - m;
+            m += delta / count;
+            m2 += delta * (x[j] - m);
+        }
+        outMean = m;
+        outVariance = count > 0 ? m2 / count : 0.;
+    }
+    // fold a run of nb values with mean mb and sum of squares m2b into (m, m2, n)
+    static void merge(double &m, double &m2, long &n, double mb, double m2b, long nb)
+    {
+        long total = n + nb;
+        double delta = mb - m;
+        m += delta * nb / total;
+        m2 += m2b + delta * delta * (double)n * nb / total;
+        n = total;
+    }
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef LAG_STREAM_H
+#define LAG_STREAM_H
+
+#include "glad.h"
+
+#include <vector>
+#include <iostream>
+
+// Streams lag rows into the lag texture through a ring of pixel unpack buffer
+// regions. Each frame the caller writes the rows that changed into the current
+// region and we upload just those rows with glTexSubImage2D; the texture itself
+// is allocated once and never reallocated. A fence per region tells us when
+// the GPU is done reading it, so it can be reused without stalling.
+//
+// With GL 4.4 the whole ring is persistently mapped once. Older contexts (macOS
+// stops at 4.1) map the current region per frame with glMapBufferRange,
+// unsynchronized because the fence already guarantees the GPU is done with it.
+//
+// Works for GL_TEXTURE_2D (one row per baseline) and GL_TEXTURE_1D_ARRAY (one
+// layer per baseline), where the y offset of glTexSubImage2D picks the row.
+
+class LagTextureStream
+{
+public:
+    unsigned int texture;
+    int width, rows;
+    bool persistent;
+    unsigned long long bytesUploaded;
+
+    LagTextureStream(unsigned int tex, unsigned int target, int rowWidth, int numRows, int ringSize = 3)
+        : texture(tex), width(rowWidth), rows(numRows), bytesUploaded(0), textureTarget(target), ring(ringSize), current(0), mapped(NULL)
+    {
+        regionBytes = (size_t)width * rows * sizeof(float);
+        fences.assign(ring, (GLsync)0);
+        persistent = GLAD_GL_VERSION_4_4 != 0;
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, regionBytes * ring, NULL, flags);
+            mapped = (float *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, regionBytes * ring, flags);
+            if (mapped == NULL) {
+                std::cout << "Persistent mapping of the lag upload buffer failed, mapping per frame instead" << std::endl;
+                persistent = false;
+                glDeleteBuffers(1, &pbo);
+                glGenBuffers(1, &pbo);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            }
+        }
+        if (!persistent) glBufferData(GL_PIXEL_UNPACK_BUFFER, regionBytes * ring, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    // change the row width and row count, up to the size the stream was
+    // created with, after the texture has been reallocated to match. The ring
+    // regions keep their full size, so a region starts at the same offset in
+    // beginFrame and endFrame whatever the shape
+    // ------------------------------------------------------------------------
+    void setShape(int rowWidth, int numRows)
+    {
+        if ((size_t)rowWidth * numRows * sizeof(float) > regionBytes) {
+            std::cout << numRows << " lag rows of " << rowWidth << " do not fit the upload buffer" << std::endl;
+            return;
+        }
+        width = rowWidth;
+        rows = numRows;
+    }
+    // release the buffer and fences; call while the context is still current
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        for (int i = 0; i < ring; i++) if (fences[i]) glDeleteSync(fences[i]);
+        fences.assign(ring, (GLsync)0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        if (persistent) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo);
+        mapped = NULL;
+    }
+    // wait until the GPU is done with this frame's region and return it
+    // (rows x width floats); only rows marked dirty in endFrame are uploaded
+    // ------------------------------------------------------------------------
+    float *beginFrame()
+    {
+        if (fences[current]) {
+            glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+            glDeleteSync(fences[current]);
+            fences[current] = 0;
+        }
+        if (persistent) return mapped + regionBytes * current / sizeof(float);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        float *region = (float *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, regionBytes * current, regionBytes,
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return region;
+    }
+    // upload the dirty rows of this frame's region, in runs of adjacent rows
+    // ------------------------------------------------------------------------
+    void endFrame(const bool *dirty)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        if (!persistent) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindTexture(textureTarget, texture);
+        size_t base = regionBytes * current;
+        int r = 0;
+        bool any = false;
+        while (r < rows) {
+            if (!dirty[r]) { r++; continue; }
+            int first = r;
+            while (r < rows && dirty[r]) r++;
+            glTexSubImage2D(textureTarget, 0, 0, first, width, r - first, GL_RED, GL_FLOAT,
+                            (void *)(base + (size_t)first * width * sizeof(float)));
+            bytesUploaded += (unsigned long long)(r - first) * width * sizeof(float);
+            any = true;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (any) fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % ring;
+    }
+
+private:
+    unsigned int textureTarget;
+    int ring;
+    int current;
+    size_t regionBytes;         // stride of the ring regions, fixed
+    unsigned int pbo;
+    float *mapped;
+    std::vector<GLsync> fences;
+};
+
+#endif
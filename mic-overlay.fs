@@ -0,0 +1,12 @@
+#version 330 core
+
+out vec4 FragColor;
+in vec2 corner;
+in vec3 markerColor;
+
+void main()
+{
+    // round markers; lines have corner (0, 0) all along
+    if (dot(corner, corner) > 1.) discard;
+    FragColor = vec4(markerColor, 1.);
+}
@@ -0,0 +1,25 @@
+#version 330 core
+
+// Mic markers (one instanced quad per mic) and the line of the selected
+// baseline, drawn over the sky dome after the imaging pass.
+
+layout (location = 0) in vec2 aCorner;   // corner of the marker quad, -1..1; (0, 0) for lines
+layout (location = 1) in vec2 aPos;      // position on the dome plan, metres
+layout (location = 2) in vec3 aColor;
+
+out vec2 corner;
+out vec3 markerColor;
+
+uniform float skyradius = 1.0;
+uniform vec2 viewportSize = vec2(1600., 1200.);
+
+void main()
+{
+    // Must match the pixel-to-dome mapping in client-ethernet-scalable.fs
+    float pixelscale = viewportSize.y / 2. / skyradius;
+    float markerRadius = 0.005 * viewportSize.y / 2.; // pixels
+    vec2 pixel = aPos * pixelscale + viewportSize / 2. + aCorner * markerRadius;
+    gl_Position = vec4(pixel / viewportSize * 2. - 1., 0., 1.);
+    corner = aCorner;
+    markerColor = aColor;
+}
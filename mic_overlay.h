@@ -0,0 +1,147 @@
+#ifndef MIC_OVERLAY_H
+#define MIC_OVERLAY_H
+
+#include "glad.h"
+
+#include "shader_s.h"
+#include "array_geometry.h"
+
+#include <vector>
+
+// Mic markers and the selected baseline, drawn on top of the sky dome plan
+// view as their own small draw calls instead of being tested for in every
+// fragment of the imaging shader. One instanced quad per mic (mic-overlay.vs
+// turns it into a round dot), plus one line between the two mics of the
+// selected baseline.
+//
+// The vertex data only changes when a mic moves or the selection changes;
+// update() compares against what was uploaded last and is cheap otherwise.
+
+class MicOverlay
+{
+public:
+    Shader shader;
+
+    MicOverlay(const char *vertexPath, const char *fragmentPath)
+        : shader(vertexPath, fragmentPath), numMarkers(0), numLineVertices(0),
+          lastMic(-1), lastBaseline(-1)
+    {
+        radiusloc = glGetUniformLocation(shader.ID, "skyradius");
+        viewportloc = glGetUniformLocation(shader.ID, "viewportSize");
+        lastGeom.numMics = -1;
+
+        // marker quad, as a triangle strip
+        float corners[] = { -1.f, -1.f, 1.f, -1.f, -1.f, 1.f, 1.f, 1.f };
+        glGenVertexArrays(2, vaos);
+        glGenBuffers(3, vbos);
+
+        glBindVertexArray(vaos[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[0]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
+        glBufferData(GL_ARRAY_BUFFER, MAXMICS * FLOATS_PER_VERTEX * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+        setVertexLayout();
+        glVertexAttribDivisor(1, 1);
+        glVertexAttribDivisor(2, 1);
+
+        // line: attribute 0 stays disabled, so its corner is (0, 0)
+        glBindVertexArray(vaos[1]);
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[2]);
+        glBufferData(GL_ARRAY_BUFFER, 2 * FLOATS_PER_VERTEX * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+        setVertexLayout();
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    // upload new markers if the positions or the selection changed: white for
+    // the selected mic, green for the mics of the selected baseline (and the
+    // line between them), blue otherwise
+    // ------------------------------------------------------------------------
+    void update(const ArrayGeometry &geom, int selectedMic, int selectedBaseline)
+    {
+        if (selectedMic == lastMic && selectedBaseline == lastBaseline && geom.sameLags(lastGeom)) return;
+        lastMic = selectedMic;
+        lastBaseline = selectedBaseline;
+        lastGeom = geom;
+
+        int m1 = -1, m2 = -1;
+        if (selectedBaseline >= 0 && selectedBaseline < geom.numBaselines) {
+            m1 = geom.baselineMics[selectedBaseline][0];
+            m2 = geom.baselineMics[selectedBaseline][1];
+        }
+
+        std::vector<float> markers;
+        for (int i = 0; i < geom.numMics; i++) {
+            if (i == selectedMic) addVertex(markers, geom.micpos[i], 1.f, 1.f, 1.f);
+            else if (i == m1 || i == m2) addVertex(markers, geom.micpos[i], 0.f, 1.f, 0.f);
+            else addVertex(markers, geom.micpos[i], 0.f, 0.f, 1.f);
+        }
+        numMarkers = geom.numMics;
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[1]);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, markers.size() * sizeof(float), &markers[0]);
+
+        numLineVertices = 0;
+        if (m1 >= 0) {
+            std::vector<float> line;
+            addVertex(line, geom.micpos[m1], 0.f, 1.f, 0.f);
+            addVertex(line, geom.micpos[m2], 0.f, 1.f, 0.f);
+            glBindBuffer(GL_ARRAY_BUFFER, vbos[2]);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, line.size() * sizeof(float), &line[0]);
+            numLineVertices = 2;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    // draw into the current framebuffer, which has the given size
+    // ------------------------------------------------------------------------
+    void draw(float skyRadius, int width, int height)
+    {
+        shader.use();
+        glUniform1f(radiusloc, skyRadius);
+        glUniform2f(viewportloc, (float)width, (float)height);
+        if (numLineVertices > 0) {
+            glBindVertexArray(vaos[1]);
+            glDrawArrays(GL_LINES, 0, numLineVertices);
+        }
+        glBindVertexArray(vaos[0]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, numMarkers);
+        glBindVertexArray(0);
+    }
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        glDeleteVertexArrays(2, vaos);
+        glDeleteBuffers(3, vbos);
+    }
+
+private:
+    // x, y on the dome plan, r, g, b
+    static const int FLOATS_PER_VERTEX = 5;
+
+    unsigned int vaos[2];   // markers, line
+    unsigned int vbos[3];   // quad corners, marker instances, line vertices
+    int radiusloc, viewportloc;
+    int numMarkers, numLineVertices;
+    int lastMic, lastBaseline;
+    ArrayGeometry lastGeom;
+
+    // attributes 1 (position) and 2 (colour) from the bound array buffer
+    void setVertexLayout()
+    {
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, FLOATS_PER_VERTEX * sizeof(float), (void*)(2 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+    }
+    static void addVertex(std::vector<float> &v, const float *pos, float r, float g, float b)
+    {
+        v.push_back(pos[0]);
+        v.push_back(pos[1]);
+        v.push_back(r);
+        v.push_back(g);
+        v.push_back(b);
+    }
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef NEARFIELD_H
+#define NEARFIELD_H
+
+#include "array_geometry.h"
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <stdint.h>
+
+// Near-field focusing. The shader images a single dome of radius skyradius, so
+// a source at a different range is smeared out and its range is unknown. Here
+// we evaluate the delay-sum metric on a stack of range slices: slice k is the
+// dome of radius range[k], sampled on the same (l, m) grid as the CPU imager.
+// The slice a source comes into focus on gives its range.
+//
+// Slices are spaced evenly in inverse range, since the focusing depth gets
+// coarser roughly with range squared. Every slice has its own delay table,
+// stored as 8.8 fixed point lag indices to keep 128x128x32 x 28 baselines at
+// 2 bytes per entry. Slices are imaged in parallel.
+
+struct NearFieldSource
+{
+    int ix, iy;      // map pixel
+    float l, m;      // direction cosines
+    float range;     // best focused range, metres
+    float value;     // delay-sum metric at best focus
+    float contrast;  // best focus relative to the mean over all slices
+};
+
+class NearFieldImager
+{
+public:
+    int size;                // each slice is size x size pixels
+    int numSlices;
+    float minRange, maxRange;
+    int numThreads;
+    int maxSources;
+    float minSeparation;     // between reported sources, in pixels
+
+    std::vector<float> volume;       // numSlices x size x size
+    std::vector<float> focusMap;     // best value over range per pixel
+    std::vector<float> focusRange;   // range of that best value per pixel
+    std::vector<NearFieldSource> sources;
+
+    NearFieldImager(int mapsize = 128, int slices = 32, float rmin = 0.25f, float rmax = 5.f)
+        : size(mapsize), numSlices(slices), minRange(rmin), maxRange(rmax), maxSources(4), minSeparation(6.f), cacheValid(false)
+    {
+        numThreads = std::thread::hardware_concurrency();
+        if (numThreads < 1) numThreads = 1;
+        if (numThreads > 8) numThreads = 8;
+    }
+    // range of slice k (evenly spaced in 1 / range)
+    // ------------------------------------------------------------------------
+    float sliceRange(float k) const
+    {
+        if (numSlices < 2) return minRange;
+        float inv = 1.f / minRange + (1.f / maxRange - 1.f / minRange) * k / (numSlices - 1);
+        return 1.f / inv;
+    }
+    float pixelL(int ix) const { return -1.f + (ix + 0.5f) * 2.f / size; }
+    float pixelM(int iy) const { return -1.f + (iy + 0.5f) * 2.f / size; }
+    // image all slices from normalised lag rows, then find the focus per pixel
+    // and the brightest sources with their best-focused range
+    // ------------------------------------------------------------------------
+    void image(const ArrayGeometry &geom, const float (*rows)[NUMLAGS], const float *weights)
+    {
+        updateCache(geom);
+        int npix = size * size;
+        volume.resize((size_t)numSlices * npix);
+
+        // zero-mean rows, and the baselines that take part
+        meanRows.resize((size_t)geom.numBaselines * NUMLAGS);
+        activeBaselines.clear();
+        activeWeights.clear();
+        float wsum = 0.;
+        for (int b = 0; b < geom.numBaselines; b++) {
+            if (weights[b] <= 0.) continue;
+            float mean = 0.;
+            for (int j = 0; j < NUMLAGS; j++) mean += rows[b][j];
+            mean /= NUMLAGS;
+            for (int j = 0; j < NUMLAGS; j++) meanRows[(size_t)b * NUMLAGS + j] = rows[b][j] - mean;
+            activeBaselines.push_back(b);
+            activeWeights.push_back(weights[b]);
+            wsum += weights[b];
+        }
+        for (size_t i = 0; i < activeWeights.size(); i++) activeWeights[i] /= wsum;
+
+        int nthreads = numThreads < numSlices ? numThreads : numSlices;
+        std::vector<std::thread> workers;
+        for (int t = 0; t < nthreads; t++) {
+            workers.push_back(std::thread(&NearFieldImager::imageSlices, this, t, nthreads, geom.numBaselines));
+        }
+        for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+        findFocus();
+        findSources();
+    }
+
+private:
+    bool cacheValid;
+    ArrayGeometry cachedGeometry;
+    int cachedSize, cachedSlices;
+    float cachedMinRange, cachedMaxRange;
+    std::vector<uint16_t> delays;    // [slice][baseline][pixel], 8.8 fixed point lag index
+    std::vector<unsigned char> inside;
+    std::vector<float> meanRows;
+    std::vector<int> activeBaselines;
+    std::vector<float> activeWeights;
+
+    void updateCache(const ArrayGeometry &geom)
+    {
+        if (cacheValid && cachedSize == size && cachedSlices == numSlices && cachedMinRange == minRange &&
+            cachedMaxRange == maxRange && geom.sameAs(cachedGeometry)) return;
+        cachedGeometry = geom;
+        cachedSize = size;
+        cachedSlices = numSlices;
+        cachedMinRange = minRange;
+        cachedMaxRange = maxRange;
+        int npix = size * size;
+        delays.resize((size_t)numSlices * geom.numBaselines * npix);
+        inside.resize(npix);
+        for (int p = 0; p < npix; p++) {
+            float l = pixelL(p % size), m = pixelM(p / size);
+            inside[p] = l * l + m * m <= 1.f;
+        }
+        for (int k = 0; k < numSlices; k++) {
+            float r = sliceRange(k);
+            for (int p = 0; p < npix; p++) {
+                float l = pixelL(p % size), m = pixelM(p / size);
+                float r2 = l * l + m * m;
+                float pos[3] = {r * l, r * m, r2 <= 1.f ? r * sqrtf(1.f - r2) : 0.f};
+                for (int b = 0; b < geom.numBaselines; b++) {
+                    float idx = geom.lagIndex(b, geom.lag(b, pos));
+                    idx = fmodf(idx, (float)NUMLAGS);
+                    if (idx < 0.) idx += NUMLAGS;
+                    int fixed = (int)(idx * 256.f);
+                    if (fixed > NUMLAGS * 256 - 1) fixed = NUMLAGS * 256 - 1;
+                    delays[((size_t)k * geom.numBaselines + b) * npix + p] = (uint16_t)fixed;
+                }
+            }
+        }
+        cacheValid = true;
+    }
+    // worker: slices t, t + nthreads, ...
+    void imageSlices(int t, int nthreads, int numBaselines)
+    {
+        int npix = size * size;
+        for (int k = t; k < numSlices; k += nthreads) {
+            float *slice = &volume[(size_t)k * npix];
+            for (int p = 0; p < npix; p++) slice[p] = 0.;
+            for (size_t a = 0; a < activeBaselines.size(); a++) {
+                int b = activeBaselines[a];
+                float w = activeWeights[a];
+                const float *row = &meanRows[(size_t)b * NUMLAGS];
+                const uint16_t *d = &delays[((size_t)k * numBaselines + b) * npix];
+                for (int p = 0; p < npix; p++) {
+                    int i0 = d[p] >> 8;
+                    int i1 = (i0 + 1 == NUMLAGS) ? 0 : i0 + 1;
+                    float f = (d[p] & 255) * (1.f / 256.f);
+                    slice[p] += w * (row[i0] + f * (row[i1] - row[i0]));
+                }
+            }
+            for (int p = 0; p < npix; p++) if (!inside[p]) slice[p] = 0.;
+        }
+    }
+    // best focus per pixel, refined between slices with a parabola
+    void findFocus()
+    {
+        int npix = size * size;
+        focusMap.resize(npix);
+        focusRange.resize(npix);
+        for (int p = 0; p < npix; p++) {
+            int best = 0;
+            for (int k = 1; k < numSlices; k++) {
+                if (volume[(size_t)k * npix + p] > volume[(size_t)best * npix + p]) best = k;
+            }
+            float kf = (float)best;
+            if (best > 0 && best < numSlices - 1) {
+                float ym = volume[(size_t)(best - 1) * npix + p];
+                float y0 = volume[(size_t)best * npix + p];
+                float yp = volume[(size_t)(best + 1) * npix + p];
+                float denom = ym - 2.f * y0 + yp;
+                if (denom < 0.) kf += 0.5f * (ym - yp) / denom;
+            }
+            focusMap[p] = volume[(size_t)best * npix + p];
+            focusRange[p] = sliceRange(kf);
+        }
+    }
+    // brightest local maxima of the focus map, at least minSeparation apart
+    void findSources()
+    {
+        sources.clear();
+        int npix = size * size;
+        for (int s = 0; s < maxSources; s++) {
+            int best = -1;
+            for (int p = 0; p < npix; p++) {
+                if (!inside[p] || focusMap[p] <= 0.) continue;
+                if (best != -1 && focusMap[p] <= focusMap[best]) continue;
+                bool separate = true;
+                for (size_t i = 0; i < sources.size() && separate; i++) {
+                    float dx = (float)(p % size - sources[i].ix), dy = (float)(p / size - sources[i].iy);
+                    separate = dx * dx + dy * dy >= minSeparation * minSeparation;
+                }
+                if (separate) best = p;
+            }
+            if (best == -1) break;
+            NearFieldSource src;
+            src.ix = best % size;
+            src.iy = best / size;
+            src.l = pixelL(src.ix);
+            src.m = pixelM(src.iy);
+            src.range = focusRange[best];
+            src.value = focusMap[best];
+            float mean = 0.;
+            for (int k = 0; k < numSlices; k++) mean += volume[(size_t)k * npix + best];
+            mean /= numSlices;
+            src.contrast = mean != 0. ? src.value / mean : 0.f;
+            sources.push_back(src);
+        }
+    }
+};
+
+#endif
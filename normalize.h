@@ -0,0 +1,117 @@
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+// Turns the raw lag words of a baseline into correlation coefficients, using
+// the per-mic words the FPGA sends ahead of the baseline packets of every dump:
+//
+//   word 0            header, 0xFE in all four bytes
+//   word 1            number of samples N in the integration period
+//   words 2m + 2, +3  sum S and sum of squares P of the samples of mic m
+//
+// For baseline i-j the lag word is C = sum x_i x_j, so
+//
+//   rho = (C - S_i S_j / N) / sqrt((P_i - S_i^2 / N) (P_j - S_j^2 / N))
+//
+// which is the Pearson correlation at that lag: no per-baseline gains or
+// offsets needed. The mic packet of a dump comes before its baseline packets
+// and covers the same samples, so each row is normalised with the powers of
+// its own dump (or, if that packet got lost, the last one received). A mic
+// with no variance, or whose power word saturated (0xFFFFFFFF), has no
+// meaningful coefficients; its rows come out as zeros.
+
+class LagNormalizer
+{
+public:
+    static const unsigned char MARKER = 0xFE;
+
+    LagNormalizer() : count(0), received(false) {}
+
+    // ------------------------------------------------------------------------
+    void setMics(int mics)
+    {
+        sums.assign(mics, 0.);
+        powers.assign(mics, 0.);
+        saturated.assign(mics, 0);
+        received = false;
+    }
+    // true if the packet header marks a mic power packet
+    // ------------------------------------------------------------------------
+    static bool isPowerPacket(const unsigned char *packet)
+    {
+        return packet[0] == MARKER && packet[1] == MARKER && packet[2] == MARKER && packet[3] == MARKER;
+    }
+    // take the words of a power packet; false if it is too short
+    // ------------------------------------------------------------------------
+    bool read(const unsigned char *packet, size_t bytes)
+    {
+        int mics = sums.size();
+        if (bytes < (size_t)(2 + 2 * mics) * 4) return false;
+        count = word(packet, 1);
+        for (int m = 0; m < mics; m++) {
+            sums[m] = (int32_t)word(packet, 2 + 2 * m);
+            uint32_t p = word(packet, 3 + 2 * m);
+            saturated[m] = p == 0xFFFFFFFFu;
+            powers[m] = p;
+        }
+        received = count > 0;
+        return true;
+    }
+    // true once a power packet has come in
+    // ------------------------------------------------------------------------
+    bool ready() const
+    {
+        return received;
+    }
+    // variance of the samples of mic m, N times (0 if unusable)
+    // ------------------------------------------------------------------------
+    double spread(int m) const
+    {
+        if (!received || saturated[m]) return 0.;
+        double v = powers[m] - sums[m] * sums[m] / count;
+        return v > 0. ? v : 0.;
+    }
+    // ------------------------------------------------------------------------
+    bool isSaturated(int m) const
+    {
+        return saturated[m];
+    }
+    // ------------------------------------------------------------------------
+    uint32_t samples() const
+    {
+        return count;
+    }
+    // lag words of baseline i-j, bins first .. NUMLAGS - 1, to coefficients
+    // in place
+    // ------------------------------------------------------------------------
+    void normalize(float *row, int first, int numLags, int i, int j) const
+    {
+        double vi = spread(i), vj = spread(j);
+        if (vi <= 0. || vj <= 0.) {
+            for (int k = first; k < numLags; k++) row[k] = 0.f;
+            return;
+        }
+        double mean = sums[i] * sums[j] / count;
+        double scale = 1. / sqrt(vi * vj);
+        for (int k = first; k < numLags; k++) row[k] = (row[k] - mean) * scale;
+    }
+    // little-endian 32-bit word w of a packet, as the FPGA sends them
+    // ------------------------------------------------------------------------
+    static uint32_t word(const unsigned char *packet, int w)
+    {
+        const unsigned char *p = packet + 4 * w;
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+private:
+    std::vector<double> sums, powers;
+    std::vector<char> saturated;
+    uint32_t count;
+    bool received;
+};
+
+#endif
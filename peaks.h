@@ -0,0 +1,178 @@
+#ifndef PEAKS_H
+#define PEAKS_H
+
+#include "tdoa_solver.h"
+#include "upsample.h"
+
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Several peaks per lag row, followed from row to row, so two sources show
+// up as two steady peaks instead of one that jumps between them.
+//
+// find() takes the local maxima of a row (higher than the left neighbour,
+// at least as high as the right one), four bins per SSE2 compare, that rise
+// more than minHeight of the row's display range above its floor. Of those
+// it keeps the highest, then the next highest at least minSeparation lags
+// from the ones kept, and so on up to numPeaks, each refined to sub-lag
+// position with a parabola.
+//
+// update() associates them with the baseline's tracks: nearest pairs first,
+// within 'gate' lags. A matched track moves to its peak; a track unmatched
+// for more than maxMissed rows is dropped; a peak without a track starts a
+// new one with a new id. Tracks count as confirmed after confirmRows
+// matched rows, and stay at their last position while they miss.
+//
+// Rows may be oversampled by 'factor' as LagUpsampler makes them (sample u
+// at lag bin (u + 0.5) / factor - 0.5); peaks are found and refined on the
+// samples, and tracks are kept in lag bins of the original row either way.
+
+class LagPeakTracker
+{
+public:
+    static const int MAXPEAKS = 4;
+
+    struct Track
+    {
+        bool active;
+        int id;
+        float bin;          // fractional lag bin
+        float height;       // above the floor, in display ranges
+        int age;            // matched rows
+        int missed;         // rows since the last match
+    };
+
+    int numPeaks;
+    float minSeparation;    // lags
+    float minHeight;        // of the display range, above the floor
+    float gate;             // lags a track may move per row
+    int maxMissed, confirmRows;
+
+    LagPeakTracker() : numPeaks(2), minSeparation(3.f), minHeight(0.25f), gate(4.f), maxMissed(5), confirmRows(2),
+                       numBaselines(0), nextId(0) {}
+
+    // ------------------------------------------------------------------------
+    void setBaselines(int baselines)
+    {
+        numBaselines = baselines;
+        Track none = {false, -1, 0.f, 0.f, 0, 0};
+        tracks.assign((size_t)baselines * MAXPEAKS, none);
+    }
+    // up to numPeaks peaks of row[first .. last] (samples, 'factor' per
+    // lag), highest first, as lag bins; returns their number
+    // ------------------------------------------------------------------------
+    int find(const float *row, int first, int last, float floor, float range, float *bins, float *heights, int factor = 1)
+    {
+        float separation = minSeparation * factor;
+        float threshold = floor + minHeight * range;
+        int count = 0;
+        int j = first + 1;
+#if defined(__SSE2__)
+        const __m128 t = _mm_set1_ps(threshold);
+        for (; j + 4 <= last; j += 4) {
+            __m128 c = _mm_loadu_ps(row + j);
+            __m128 left = _mm_loadu_ps(row + j - 1);
+            __m128 right = _mm_loadu_ps(row + j + 1);
+            __m128 isPeak = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(c, left), _mm_cmpge_ps(c, right)), _mm_cmpgt_ps(c, t));
+            int bits = _mm_movemask_ps(isPeak);
+            for (; bits != 0; bits &= bits - 1) {
+                int lane = bits & 1 ? 0 : (bits & 2 ? 1 : (bits & 4 ? 2 : 3));
+                candidates[count++] = j + lane;
+            }
+        }
+#endif
+        for (; j < last; j++) {
+            if (row[j] > row[j - 1] && row[j] >= row[j + 1] && row[j] > threshold) candidates[count++] = j;
+        }
+
+        int found = 0;
+        int limit = numPeaks < MAXPEAKS ? numPeaks : MAXPEAKS;
+        while (found < limit) {
+            int best = -1;
+            for (int c = 0; c < count; c++) {
+                if (candidates[c] < 0) continue;
+                if (best < 0 || row[candidates[c]] > row[candidates[best]]) best = c;
+            }
+            if (best < 0) break;
+            int bin = candidates[best];
+            float u = TDOASolver::refinePeak(row, bin, first, last);
+            bins[found] = (u + 0.5f) / factor - 0.5f;
+            heights[found] = range > 0.f ? (row[bin] - floor) / range : 0.f;
+            found++;
+            for (int c = 0; c < count; c++) {
+                if (candidates[c] >= 0 && fabsf(candidates[c] - u) < separation) candidates[c] = -1;
+            }
+        }
+        return found;
+    }
+    // find the peaks of baseline b's new row and move its tracks on
+    // ------------------------------------------------------------------------
+    void update(int b, const float *row, int first, int last, float floor, float range, int factor = 1)
+    {
+        float bins[MAXPEAKS], heights[MAXPEAKS];
+        int found = find(row, first, last, floor, range, bins, heights, factor);
+        Track *t = &tracks[(size_t)b * MAXPEAKS];
+
+        // nearest track-peak pairs first
+        bool trackUsed[MAXPEAKS] = {false}, peakUsed[MAXPEAKS] = {false};
+        for (;;) {
+            int bestTrack = -1, bestPeak = -1;
+            float bestDistance = gate;
+            for (int k = 0; k < MAXPEAKS; k++) {
+                if (!t[k].active || trackUsed[k]) continue;
+                for (int p = 0; p < found; p++) {
+                    float d = fabsf(t[k].bin - bins[p]);
+                    if (!peakUsed[p] && d <= bestDistance) {
+                        bestDistance = d;
+                        bestTrack = k;
+                        bestPeak = p;
+                    }
+                }
+            }
+            if (bestTrack < 0) break;
+            trackUsed[bestTrack] = true;
+            peakUsed[bestPeak] = true;
+            Track &m = t[bestTrack];
+            m.bin = bins[bestPeak];
+            m.height = heights[bestPeak];
+            m.age++;
+            m.missed = 0;
+        }
+        for (int k = 0; k < MAXPEAKS; k++) {
+            if (t[k].active && !trackUsed[k] && ++t[k].missed > maxMissed) t[k].active = false;
+        }
+        for (int p = 0; p < found; p++) {
+            if (peakUsed[p]) continue;
+            for (int k = 0; k < MAXPEAKS; k++) {
+                if (t[k].active) continue;
+                Track fresh = {true, nextId++, bins[p], heights[p], 1, 0};
+                t[k] = fresh;
+                break;
+            }
+        }
+    }
+    // track k (0 .. MAXPEAKS - 1) of baseline b
+    // ------------------------------------------------------------------------
+    const Track &track(int b, int k) const
+    {
+        return tracks[(size_t)b * MAXPEAKS + k];
+    }
+    // ------------------------------------------------------------------------
+    bool confirmed(int b, int k) const
+    {
+        const Track &t = track(b, k);
+        return t.active && t.age >= confirmRows;
+    }
+
+private:
+    int numBaselines;
+    int nextId;
+    std::vector<Track> tracks;      // [baseline][MAXPEAKS]
+    int candidates[NUMLAGS * LagUpsampler::MAXFACTOR];
+};
+
+#endif
@@ -0,0 +1,46 @@
+#version 330 core
+
+// Offscreen pass for client-ethernet-scalable.fs: the geometric lag of every
+// baseline at every window pixel on the sky dome. Only the mic positions, the
+// dome radius and the window size go into it, so it is rerun only when one of
+// those changes instead of for every frame.
+//
+// Four baselines are packed per texel; pass 'layer' writes baselines
+// 4 * layer ... 4 * layer + 3 into that layer of the lag table.
+//
+// NUMMICS, NUMBASELINES, the ArrayBlock uniform block (mic positions, pair
+// table) and baselinePair() are inserted by the client, see array_uniforms.h.
+
+out vec4 FragColor;
+in vec3 ourColor;
+in vec2 TexCoord;
+
+uniform int layer = 0;
+uniform float skyradius = 1.0;
+// size of the table, the render size of client-ethernet-scalable.fs
+uniform vec2 viewportSize = vec2(1600., 1200.);
+
+float soundspeed = 343.;
+float samplerate = 46875.;
+
+void main()
+{
+    // Must match the pixel-to-dome mapping in client-ethernet-scalable.fs
+    float pixelscale = viewportSize.y / 2. / skyradius;
+
+    vec3 pixelpos = vec3((gl_FragCoord.xy - viewportSize / 2.) / pixelscale, 0.);
+    if (length(pixelpos) > skyradius) {
+      FragColor = vec4(0.);
+      return;
+    }
+    pixelpos.z = sqrt(skyradius * skyradius - pixelpos.x * pixelpos.x - pixelpos.y * pixelpos.y);
+
+    vec4 lags = vec4(0.);
+    for (int k = 0; k < 4; k++) {
+      int b = 4 * layer + k;
+      if (b >= NUMBASELINES) break;
+      ivec2 pair = baselinePair(b);
+      lags[k] = samplerate * (length(pixelpos - micpos[pair.y].xyz) - length(pixelpos - micpos[pair.x].xyz)) / soundspeed;
+    }
+    FragColor = lags;
+}
@@ -0,0 +1,101 @@
+#ifndef PIXEL_LAGS_H
+#define PIXEL_LAGS_H
+
+#include "glad.h"
+
+#include "shader_s.h"
+#include "array_geometry.h"
+
+#include <string>
+#include <iostream>
+
+// Per-pixel lag table on the GPU. The geometric lags of the sky dome only
+// change when a mic moves, the dome radius changes or the render size changes,
+// so instead of working them out in the imaging shader for every pixel of
+// every frame, an offscreen pass (pixel-lags.fs) renders them once into a
+// 2D texture array at the render resolution. Four baselines go in each RGBA32F
+// layer; the imaging shader then only fetches NUMBASELINES / 4 texels.
+// The program's uniform blocks still have to be attached by the caller.
+//
+// The table grows with pixels x baselines; beyond maxBytes (large arrays on
+// big windows) it is not kept at all and 'enabled' is false, so the imaging
+// shader has to work the lags out itself.
+
+class PixelLagTable
+{
+public:
+    unsigned int texture;
+    int width, height, layers;
+    size_t maxBytes;
+    bool enabled;
+    Shader shader;
+
+    // the shader reads the mic positions from the array uniform block, so
+    // it needs the same preamble as the imaging shader
+    PixelLagTable(const char *vertexPath, const char *fragmentPath, const std::string &preamble)
+        : texture(0), width(0), height(0), layers(0), maxBytes((size_t)512 << 20), enabled(false),
+          shader(vertexPath, fragmentPath, preamble), fbo(0), valid(false)
+    {
+        layerloc = glGetUniformLocation(shader.ID, "layer");
+        radiusloc = glGetUniformLocation(shader.ID, "skyradius");
+        sizeloc = glGetUniformLocation(shader.ID, "viewportSize");
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &texture);
+    }
+    // rerender the table if the array or the render size changed (the mic
+    // positions in the uniform block must be up to date); leaves the
+    // default framebuffer bound and the viewport at the table size. Returns
+    // true if the table was rerendered
+    // ------------------------------------------------------------------------
+    bool update(const ArrayGeometry &geom, int w, int h, unsigned int vao)
+    {
+        int l = (geom.numBaselines + 3) / 4;
+        if (w == width && h == height && l == layers && (!enabled || (valid && geom.sameLags(cached)))) return false;
+        if (w != width || h != height || l != layers) {
+            width = w;
+            height = h;
+            layers = l;
+            size_t bytes = (size_t)width * height * layers * 4 * sizeof(float);
+            enabled = bytes <= maxBytes;
+            glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            if (!enabled) {
+                std::cout << "Per-pixel lag table would take " << (bytes >> 20) << " MB, computing lags per frame instead" << std::endl;
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, 1, 1, 1, 0, GL_RGBA, GL_FLOAT, NULL);
+                valid = false;
+                return false;
+            }
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, width, height, layers, 0, GL_RGBA, GL_FLOAT, NULL);
+        }
+        cached = geom;
+
+        shader.use();
+        glUniform1f(radiusloc, geom.skyRadius);
+        glUniform2f(sizeloc, (float)width, (float)height);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+        glBindVertexArray(vao);
+        for (int i = 0; i < layers; i++) {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, i);
+            if (i == 0 && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cout << "Pixel lag table framebuffer is not complete" << std::endl;
+                break;
+            }
+            glUniform1i(layerloc, i);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+        valid = true;
+        return true;
+    }
+
+private:
+    unsigned int fbo;
+    int layerloc, radiusloc, sizeloc;
+    bool valid;
+    ArrayGeometry cached;
+};
+
+#endif
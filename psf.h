@@ -0,0 +1,241 @@
+#ifndef PSF_H
+#define PSF_H
+
+#include "array_geometry.h"
+#include "cpu_imager.h"
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <cmath>
+#include <stdint.h>
+
+// Point-spread function of the array: the delay-sum map of a unit point source
+// at zenith, for the current mic positions and sample rate. It is made exactly
+// like the shader would make it: a synthetic lag row per baseline holding the
+// source's lag response, looked up with the same lag model and the same
+// bilinear interpolation. Lag offsets shift the synthetic row and the lookup
+// alike, so they cancel out of the PSF.
+//
+// The PSF is twice the size of the map it belongs to (peak at (n, n)), so it
+// can be shifted to any map pixel. Offsets outside the dome have no exact sky
+// position; there we continue the lags linearly in the direction cosines, which
+// is what the far field does anyway.
+
+struct PSF
+{
+    int n;                   // size of the map this PSF belongs to
+    int size;                // 2 * n
+    std::vector<float> data; // size x size, peak at (n, n)
+    float beamSigma;         // Gaussian fitted to the main lobe, in pixels
+    float mainLobeRadius;    // distance to the first null (or 20% level), in pixels
+    float peakSidelobe;      // highest sidelobe relative to the peak
+
+    float at(int x, int y) const { return data[(size_t)y * size + x]; }
+};
+
+// Computes PSFs in parallel and keeps the most recent ones around, keyed by a
+// hash of everything they depend on. Positions are quantised to 0.1 mm (and
+// weights to 1e-3) before hashing, so nudging a mic and nudging it back lands
+// on the same entry despite float rounding.
+class PSFCache
+{
+public:
+    int capacity;
+    float kernelLags;        // half width of a point source's lag response
+    int numThreads;
+    int hits, misses;
+
+    PSFCache(int cap = 8) : capacity(cap), kernelLags(1.f), hits(0), misses(0), useCounter(0)
+    {
+        numThreads = std::thread::hardware_concurrency();
+        if (numThreads < 1) numThreads = 1;
+        if (numThreads > 8) numThreads = 8;
+    }
+    // PSF for this geometry, map grid and set of baseline weights
+    // ------------------------------------------------------------------------
+    std::shared_ptr<const PSF> get(const ArrayGeometry &geom, const CPUImager &imager, const float *weights)
+    {
+        std::vector<int32_t> key;
+        makeKey(geom, imager.size, weights, key);
+        uint64_t h = hashKey(key);
+        std::map<uint64_t, Entry>::iterator it = entries.find(h);
+        if (it != entries.end() && it->second.key == key) {
+            hits++;
+            it->second.lastUse = ++useCounter;
+            return it->second.psf;
+        }
+        misses++;
+        std::shared_ptr<PSF> psf(new PSF());
+        compute(geom, imager, weights, *psf);
+        if (it == entries.end() && (int)entries.size() >= capacity) evictOldest();
+        Entry &e = entries[h];
+        e.key = key;
+        e.psf = psf;
+        e.lastUse = ++useCounter;
+        return psf;
+    }
+
+private:
+    struct Entry
+    {
+        std::vector<int32_t> key;
+        std::shared_ptr<const PSF> psf;
+        unsigned long lastUse;
+    };
+    std::map<uint64_t, Entry> entries;
+    unsigned long useCounter;
+
+    static int32_t quantise(float v, float step)
+    {
+        return (int32_t)floorf(v / step + 0.5f);
+    }
+    void makeKey(const ArrayGeometry &geom, int n, const float *weights, std::vector<int32_t> &key)
+    {
+        key.clear();
+        key.push_back(geom.numMics);
+        key.push_back(n);
+        key.push_back(quantise(geom.skyRadius, 1e-4f));
+        key.push_back(quantise(geom.sampleRate, 1.f));
+        key.push_back(quantise(kernelLags, 1e-3f));
+        for (int i = 0; i < geom.numMics; i++) {
+            for (int k = 0; k < 3; k++) key.push_back(quantise(geom.micpos[i][k], 1e-4f));
+        }
+        for (int b = 0; b < geom.numBaselines; b++) {
+            key.push_back(weights[b] > 0. ? quantise(weights[b], 1e-3f) : 0);
+        }
+    }
+    // 64-bit FNV-1a
+    static uint64_t hashKey(const std::vector<int32_t> &key)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < key.size(); i++) {
+            uint32_t v = (uint32_t)key[i];
+            for (int byte = 0; byte < 4; byte++) {
+                h ^= (v >> (8 * byte)) & 0xff;
+                h *= 1099511628211ULL;
+            }
+        }
+        return h;
+    }
+    void evictOldest()
+    {
+        std::map<uint64_t, Entry>::iterator oldest = entries.begin();
+        for (std::map<uint64_t, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            if (it->second.lastUse < oldest->second.lastUse) oldest = it;
+        }
+        if (oldest != entries.end()) entries.erase(oldest);
+    }
+
+    // lag response of a point source, sampled at distance x (in lags) from it
+    float kernel(float x) const
+    {
+        float t = 1.f - fabsf(x) / kernelLags;
+        return t > 0. ? t : 0.f;
+    }
+    void compute(const ArrayGeometry &geom, const CPUImager &imager, const float *weights, PSF &psf)
+    {
+        int n = imager.size;
+        psf.n = n;
+        psf.size = 2 * n;
+        psf.data.assign((size_t)psf.size * psf.size, 0.f);
+
+        // lag index of the source in every baseline's synthetic lag row
+        float src[3] = {0., 0., geom.skyRadius};
+        std::vector<float> srcIndex(geom.numBaselines);
+        float wsum = 0.;
+        for (int b = 0; b < geom.numBaselines; b++) {
+            srcIndex[b] = geom.lagIndex(b, geom.lag(b, src));
+            if (weights[b] > 0.) wsum += weights[b];
+        }
+        if (wsum > 0.) {
+            int nthreads = numThreads;
+            if (nthreads > psf.size) nthreads = psf.size;
+            std::vector<std::thread> workers;
+            int rowsPerThread = (psf.size + nthreads - 1) / nthreads;
+            for (int t = 0; t < nthreads; t++) {
+                int y0 = t * rowsPerThread;
+                int y1 = y0 + rowsPerThread;
+                if (y1 > psf.size) y1 = psf.size;
+                workers.push_back(std::thread(&PSFCache::computeRows, this, std::cref(geom), imager.pixelSize(),
+                                              weights, 1.f / wsum, &srcIndex[0], y0, y1, &psf));
+            }
+            for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+        }
+        analyse(psf);
+    }
+    void computeRows(const ArrayGeometry &geom, float pix, const float *weights, float invwsum,
+                     const float *srcIndex, int y0, int y1, PSF *psf) const
+    {
+        int n = psf->n;
+        float lpm = geom.lagsPerMeter();
+        float src[3] = {0., 0., geom.skyRadius};
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < psf->size; x++) {
+                float dl = (x - n) * pix, dm = (y - n) * pix;
+                float r2 = dl * dl + dm * dm;
+                float pos[3] = {geom.skyRadius * dl, geom.skyRadius * dm, r2 <= 1.f ? geom.skyRadius * sqrtf(1.f - r2) : 0.f};
+                float v = 0.;
+                for (int b = 0; b < geom.numBaselines; b++) {
+                    if (weights[b] <= 0.) continue;
+                    float lag;
+                    if (r2 <= 1.f) {
+                        lag = geom.lag(b, pos);
+                    } else {
+                        const float *m1 = geom.micpos[geom.baselineMics[b][0]];
+                        const float *m2 = geom.micpos[geom.baselineMics[b][1]];
+                        lag = geom.lag(b, src) + lpm * ((m1[0] - m2[0]) * dl + (m1[1] - m2[1]) * dm);
+                    }
+                    // bilinear lookup into the synthetic row, as the shader does
+                    float idx = geom.lagIndex(b, lag);
+                    float i0 = floorf(idx);
+                    float f = idx - i0;
+                    float s = (1.f - f) * kernel(i0 - srcIndex[b]) + f * kernel(i0 + 1.f - srcIndex[b]);
+                    v += weights[b] * s;
+                }
+                psf->data[(size_t)y * psf->size + x] = v * invwsum;
+            }
+        }
+    }
+    // main lobe width, clean beam and peak sidelobe level
+    // ------------------------------------------------------------------------
+    static void analyse(PSF &psf)
+    {
+        int n = psf.n;
+        float peak = psf.at(n, n);
+        psf.beamSigma = 1.f;
+        psf.mainLobeRadius = 1.f;
+        psf.peakSidelobe = 0.;
+        if (peak <= 0.) return;
+        // walk out from the centre along 8 directions, to the half power
+        // point and to the first minimum (or the 20% level, as the lobe of
+        // a sparse array often just tails off without a clear null)
+        const int dirs[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+        float halfsum = 0., nullsum = 0.;
+        for (int d = 0; d < 8; d++) {
+            float diag = (dirs[d][0] && dirs[d][1]) ? 1.41421356f : 1.f;
+            int r = 0;
+            while (r < n - 1 && psf.at(n + dirs[d][0] * (r + 1), n + dirs[d][1] * (r + 1)) > 0.5f * peak) r++;
+            halfsum += (r + 0.5f) * diag;
+            r = 0;
+            while (r < n - 1 && psf.at(n + dirs[d][0] * r, n + dirs[d][1] * r) > 0.2f * peak &&
+                   psf.at(n + dirs[d][0] * (r + 1), n + dirs[d][1] * (r + 1)) < psf.at(n + dirs[d][0] * r, n + dirs[d][1] * r)) r++;
+            nullsum += r * diag;
+        }
+        float sigma = (halfsum / 8.f) / 1.17741f;
+        psf.beamSigma = sigma < 0.5f ? 0.5f : sigma;
+        psf.mainLobeRadius = nullsum / 8.f;
+        float r2null = psf.mainLobeRadius * psf.mainLobeRadius;
+        float sidelobe = 0.;
+        for (int y = 0; y < psf.size; y++) {
+            for (int x = 0; x < psf.size; x++) {
+                float d2 = (float)((x - n) * (x - n) + (y - n) * (y - n));
+                if (d2 > r2null && psf.at(x, y) > sidelobe) sidelobe = psf.at(x, y);
+            }
+        }
+        psf.peakSidelobe = sidelobe / peak;
+    }
+};
+
+#endif
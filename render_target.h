@@ -0,0 +1,141 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include "glad.h"
+
+#include <cmath>
+#include <iostream>
+
+// Offscreen target for the imaging pass at an adjustable fraction of the
+// window resolution, upscaled into the window afterwards. The imaging shader
+// costs (pixels x baselines), so on high-DPI screens and with big arrays it
+// is rendered at whatever resolution keeps it inside a time budget:
+//
+//   addSample() takes the GPU time of each imaging pass as it comes back
+//   from the frame timer (frame_timer.h) and smooths it; adapt() moves
+//   'scale' towards budget / measured time. The pixel count goes with scale
+//   squared, hence the square root.
+//
+// Scale steps are coarse (1/32) and a change is followed by a settling
+// period, so the target (and the per-pixel lag table that follows its size)
+// is not reallocated every frame.
+//
+// The target is half float so the map is kept unclamped (frame capture can
+// read it back as it is); the blit into the window clamps it for display.
+
+class RenderTarget
+{
+public:
+    unsigned int fbo, texture;
+    int width, height;      // current render size
+    float scale;            // render size / window size
+    float minScale, maxScale;
+    float budget;           // ms for the imaging pass
+    float measured;         // smoothed ms of the imaging pass, 0 until known
+    bool dynamic;           // false: always render at maxScale
+
+    RenderTarget(float budgetMs)
+        : fbo(0), texture(0), width(0), height(0), scale(1.f), minScale(0.25f), maxScale(1.f),
+          budget(budgetMs), measured(0.f), dynamic(true), windowWidth(0), windowHeight(0),
+          settle(0)
+    {
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &texture);
+    }
+    // size the target for the current window size and scale; true if it
+    // was reallocated
+    // ------------------------------------------------------------------------
+    bool resize(int fbWidth, int fbHeight)
+    {
+        windowWidth = fbWidth;
+        windowHeight = fbHeight;
+        int w = (int)(fbWidth * scale + 0.5f);
+        int h = (int)(fbHeight * scale + 0.5f);
+        if (w < 1) w = 1;
+        if (h < 1) h = 1;
+        if (w == width && h == height) return false;
+        width = w;
+        height = h;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Render target framebuffer is not complete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return true;
+    }
+    // bind the target and set the viewport to it
+    // ------------------------------------------------------------------------
+    void bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+    }
+    // upscale into the window framebuffer; leaves it bound with the viewport
+    // at the window size
+    // ------------------------------------------------------------------------
+    void blit()
+    {
+        blit(fbo);
+    }
+    // same for another framebuffer of the render size, e.g. a processed copy
+    // ------------------------------------------------------------------------
+    void blit(unsigned int source)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+    }
+    // one measured imaging pass, in ms
+    // ------------------------------------------------------------------------
+    void addSample(float ms)
+    {
+        measured = measured > 0.f ? 0.8f * measured + 0.2f * ms : ms;
+        if (settle > 0) settle--;
+    }
+    // pick a new scale from the measurements; true if the scale changed
+    // (resize() then reallocates the target)
+    // ------------------------------------------------------------------------
+    bool adapt()
+    {
+        float target = scale;
+        if (!dynamic) {
+            target = maxScale;
+        } else if (measured > 0.f && settle == 0) {
+            // some slack below the budget so it does not oscillate around it
+            if (measured > budget || measured < 0.6f * budget) {
+                target = scale * sqrtf(0.8f * budget / measured);
+            }
+        }
+        if (target < minScale) target = minScale;
+        if (target > maxScale) target = maxScale;
+        target = floorf(target * 32.f + 0.5f) / 32.f;
+        if (target == scale) return false;
+        scale = target;
+        measured = 0.f;
+        settle = SETTLEFRAMES;
+        return true;
+    }
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteTextures(1, &texture);
+    }
+
+private:
+    static const int SETTLEFRAMES = 10;
+
+    int windowWidth, windowHeight;
+    int settle;     // timed frames to wait after a scale change
+};
+
+#endif
@@ -4,17 +4,32 @@
 #include "glad.h"
 
 #include <string>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <cstring>
+#include <algorithm>
+#include <sys/stat.h>
+
+// Linked programs are cached in this directory (created when needed) with
+// glGetProgramBinary, under a hash of the final source text and the driver
+// strings, so an unchanged shader on the same driver skips compiling and
+// linking. Any cache entry the driver does not accept is recompiled and
+// replaced.
+#define SHADER_CACHE_DIR "shadercache"
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly, or loads it from the
+    // binary cache; a non-empty preamble is inserted into both shaders right
+    // after their #version line
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &preamble = "")
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -39,11 +54,17 @@ public:
             // convert stream into string
             vertexCode   = vShaderStream.str();
             fragmentCode = fShaderStream.str();
+            if (!preamble.empty()) {
+                vertexCode.insert(vertexCode.find('\n') + 1, preamble);
+                fragmentCode.insert(fragmentCode.find('\n') + 1, preamble);
+            }
         }
         catch (std::ifstream::failure& e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
         }
+        std::string cachePath = cacheFile(vertexCode, fragmentCode);
+        if (loadBinary(cachePath)) return;
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -62,11 +83,13 @@ public:
         ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
+        if (!cachePath.empty()) glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        saveBinary(cachePath);
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -92,6 +115,78 @@ public:
     }
 
 private:
+    // cache file for these sources on this driver, or "" if the driver
+    // cannot hand out program binaries
+    // ------------------------------------------------------------------------
+    static std::string cacheFile(const std::string &vertexCode, const std::string &fragmentCode)
+    {
+        if (!glad_glGetProgramBinary || !glad_glProgramBinary || !glad_glProgramParameteri) return "";
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0) return "";
+
+        // FNV-1a over the sources and everything that identifies the driver
+        unsigned long long hash = 14695981039346656037ULL;
+        const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+        std::string key = vertexCode + '\0' + fragmentCode;
+        for (int i = 0; i < 4; i++) {
+            const GLubyte *name = glGetString(names[i]);
+            key += '\0';
+            if (name) key += (const char *)name;
+        }
+        for (size_t i = 0; i < key.size(); i++) {
+            hash ^= (unsigned char)key[i];
+            hash *= 1099511628211ULL;
+        }
+        std::ostringstream path;
+        path << SHADER_CACHE_DIR << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+        return path.str();
+    }
+    // create the program from a cache file; false (and no program) if there
+    // is no usable entry
+    // ------------------------------------------------------------------------
+    bool loadBinary(const std::string &path)
+    {
+        if (path.empty()) return false;
+        std::ifstream f(path.c_str(), std::ios::binary);
+        if (!f) return false;
+        std::vector<char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+        GLenum format;
+        if (data.size() <= sizeof(format)) return false;
+        memcpy(&format, &data[0], sizeof(format));
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        std::vector<GLint> formats(numFormats);
+        if (numFormats > 0) glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+        if (std::find(formats.begin(), formats.end(), (GLint)format) == formats.end()) return false;
+
+        ID = glCreateProgram();
+        glProgramBinary(ID, format, &data[sizeof(format)], data.size() - sizeof(format));
+        int success;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (success) return true;
+        // stale or from a different driver build: compile from source
+        glDeleteProgram(ID);
+        return false;
+    }
+    // ------------------------------------------------------------------------
+    void saveBinary(const std::string &path)
+    {
+        int success, length = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (path.empty() || !success) return;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        GLenum format;
+        std::vector<char> data(sizeof(format) + length);
+        glGetProgramBinary(ID, length, NULL, &format, &data[sizeof(format)]);
+        memcpy(&data[0], &format, sizeof(format));
+
+        mkdir(SHADER_CACHE_DIR, 0755);
+        std::ofstream f(path.c_str(), std::ios::binary);
+        f.write(&data[0], data.size());
+        if (!f) std::cout << "Could not write shader cache " << path << std::endl;
+    }
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(unsigned int shader, std::string type)
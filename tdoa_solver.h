@@ -0,0 +1,253 @@
+#ifndef TDOA_SOLVER_H
+#define TDOA_SOLVER_H
+
+#include "array_geometry.h"
+
+#include <cmath>
+
+// Localises a single dominant source straight from the per-baseline peak lags,
+// without forming an image. Each baseline contributes one time difference of
+// arrival; we fit either a far-field direction (azimuth/elevation) or a 3D
+// position to all of them with weighted Gauss-Newton (Levenberg-Marquardt
+// damped), starting from the previous frame's answer. Baselines whose residual
+// is far off get down-weighted (Huber), so a single spurious peak does not
+// drag the solution around.
+
+enum TDOAMode { TDOA_DIRECTION, TDOA_POSITION };
+
+struct TDOASolution
+{
+    bool valid;
+    float azimuth;     // radians, 0 along +x, counter-clockwise
+    float elevation;   // radians, 0 on the horizon, pi/2 at zenith
+    float pos[3];      // metres; on the sky dome in direction mode
+    float rms;         // weighted rms lag residual, in lags
+    int iterations;
+    int usedBaselines;
+};
+
+class TDOASolver
+{
+public:
+    TDOAMode mode;
+    int maxIterations;
+    float huberLags;   // residual (in lags) beyond which a baseline gets down-weighted
+    float gateLags;    // slack beyond the physical maximum lag before a peak is rejected
+    TDOASolution solution;
+
+    TDOASolver() : mode(TDOA_DIRECTION), maxIterations(8), huberLags(1.5f), gateLags(2.f)
+    {
+        reset();
+    }
+    // forget the warm start and begin again from zenith
+    // ------------------------------------------------------------------------
+    void reset()
+    {
+        solution.valid = false;
+        solution.azimuth = 0.;
+        solution.elevation = M_PI / 2.;
+        solution.pos[0] = 0.;
+        solution.pos[1] = 0.;
+        solution.pos[2] = 1.;
+        solution.rms = 0.;
+        solution.iterations = 0;
+        solution.usedBaselines = 0;
+    }
+    // refine a peak bin to sub-lag precision with a parabola through its
+    // neighbours; returns the fractional bin index
+    // ------------------------------------------------------------------------
+    static float refinePeak(const float *row, int bin, int firstBin, int lastBin)
+    {
+        if (bin <= firstBin || bin >= lastBin) return (float)bin;
+        float ym = row[bin - 1];
+        float y0 = row[bin];
+        float yp = row[bin + 1];
+        float denom = ym - 2.f * y0 + yp;
+        if (denom >= 0.) return (float)bin;
+        float delta = 0.5f * (ym - yp) / denom;
+        if (delta > 0.5f) delta = 0.5f;
+        if (delta < -0.5f) delta = -0.5f;
+        return bin + delta;
+    }
+    // fit the measured lags (in samples, already corrected for lag offsets).
+    // weights[b] <= 0 excludes a baseline.
+    // ------------------------------------------------------------------------
+    const TDOASolution &solve(const ArrayGeometry &geom, const float *lags, const float *weights)
+    {
+        float w[MAXBASELINES];
+        int used = 0;
+        for (int b = 0; b < geom.numBaselines; b++) {
+            w[b] = weights[b];
+            if (w[b] > 0. && fabsf(lags[b]) > geom.maxLag(b) + gateLags) w[b] = 0.;
+            if (w[b] > 0.) used++;
+        }
+        solution.usedBaselines = used;
+        int nparams = (mode == TDOA_DIRECTION) ? 2 : 3;
+        if (used < nparams + 1) {
+            solution.valid = false;
+            return solution;
+        }
+
+        float x[3];
+        if (mode == TDOA_DIRECTION) {
+            x[0] = solution.azimuth;
+            x[1] = solution.elevation;
+            x[2] = 0.;
+        } else {
+            x[0] = solution.pos[0];
+            x[1] = solution.pos[1];
+            x[2] = solution.pos[2];
+        }
+
+        float lambda = 1e-3f;
+        float cost = evaluate(geom, lags, w, x, NULL, NULL);
+        int it = 0;
+        for (; it < maxIterations; it++) {
+            float JtJ[3][3], Jtr[3];
+            evaluate(geom, lags, w, x, JtJ, Jtr);
+            float step[3];
+            bool improved = false;
+            for (int tries = 0; tries < 4 && !improved; tries++) {
+                float A[3][3];
+                for (int i = 0; i < nparams; i++) {
+                    for (int j = 0; j < nparams; j++) A[i][j] = JtJ[i][j];
+                    A[i][i] += lambda * (JtJ[i][i] + 1e-6f);
+                }
+                if (!solveNormal(A, Jtr, step, nparams)) break;
+                float xn[3] = {x[0] + step[0], x[1] + step[1], nparams == 3 ? x[2] + step[2] : 0.f};
+                constrain(xn);
+                float newcost = evaluate(geom, lags, w, xn, NULL, NULL);
+                if (newcost <= cost) {
+                    x[0] = xn[0]; x[1] = xn[1]; x[2] = xn[2];
+                    cost = newcost;
+                    lambda *= 0.3f;
+                    improved = true;
+                } else {
+                    lambda *= 10.f;
+                }
+            }
+            if (!improved) break;
+            float stepsize = fabsf(step[0]) + fabsf(step[1]) + (nparams == 3 ? fabsf(step[2]) : 0.f);
+            if (stepsize < 1e-5f) { it++; break; }
+        }
+
+        float wsum = 0.;
+        for (int b = 0; b < geom.numBaselines; b++) wsum += w[b];
+        solution.rms = sqrtf(cost / wsum);
+        solution.iterations = it;
+        solution.valid = true;
+        if (mode == TDOA_DIRECTION) {
+            solution.azimuth = x[0];
+            solution.elevation = x[1];
+            solution.pos[0] = geom.skyRadius * cosf(x[1]) * cosf(x[0]);
+            solution.pos[1] = geom.skyRadius * cosf(x[1]) * sinf(x[0]);
+            solution.pos[2] = geom.skyRadius * sinf(x[1]);
+        } else {
+            solution.pos[0] = x[0];
+            solution.pos[1] = x[1];
+            solution.pos[2] = x[2];
+            float horiz = sqrtf(x[0] * x[0] + x[1] * x[1]);
+            solution.azimuth = atan2f(x[1], x[0]);
+            solution.elevation = atan2f(x[2], horiz);
+        }
+        return solution;
+    }
+
+private:
+    // weighted, Huber-robustified cost at parameters x. If JtJ/Jtr are given,
+    // also accumulates the normal equations of the linearised problem.
+    // ------------------------------------------------------------------------
+    float evaluate(const ArrayGeometry &geom, const float *lags, const float *w, const float *x, float JtJ[3][3], float Jtr[3])
+    {
+        if (JtJ) {
+            for (int i = 0; i < 3; i++) {
+                Jtr[i] = 0.;
+                for (int j = 0; j < 3; j++) JtJ[i][j] = 0.;
+            }
+        }
+        // direction mode: plane wave from unit vector u, and its derivatives
+        float u[3] = {0., 0., 0.}, du_daz[3] = {0., 0., 0.}, du_del[3] = {0., 0., 0.};
+        if (mode == TDOA_DIRECTION) {
+            float ca = cosf(x[0]), sa = sinf(x[0]), ce = cosf(x[1]), se = sinf(x[1]);
+            u[0] = ce * ca;       u[1] = ce * sa;       u[2] = se;
+            du_daz[0] = -ce * sa; du_daz[1] = ce * ca;  du_daz[2] = 0.;
+            du_del[0] = -se * ca; du_del[1] = -se * sa; du_del[2] = ce;
+        }
+        const float lpm = geom.lagsPerMeter();
+        float cost = 0.;
+        for (int b = 0; b < geom.numBaselines; b++) {
+            if (w[b] <= 0.) continue;
+            const float *m1 = geom.micpos[geom.baselineMics[b][0]];
+            const float *m2 = geom.micpos[geom.baselineMics[b][1]];
+            float pred, J[3] = {0., 0., 0.};
+            if (mode == TDOA_DIRECTION) {
+                // far field: |p - m2| - |p - m1| -> (m1 - m2) . u
+                float d[3] = {m1[0] - m2[0], m1[1] - m2[1], m1[2] - m2[2]};
+                pred = lpm * (d[0] * u[0] + d[1] * u[1] + d[2] * u[2]);
+                J[0] = lpm * (d[0] * du_daz[0] + d[1] * du_daz[1] + d[2] * du_daz[2]);
+                J[1] = lpm * (d[0] * du_del[0] + d[1] * du_del[1] + d[2] * du_del[2]);
+            } else {
+                float r1 = ArrayGeometry::distance(x, m1);
+                float r2 = ArrayGeometry::distance(x, m2);
+                if (r1 < 1e-6f) r1 = 1e-6f;
+                if (r2 < 1e-6f) r2 = 1e-6f;
+                pred = lpm * (r2 - r1);
+                for (int k = 0; k < 3; k++) J[k] = lpm * ((x[k] - m2[k]) / r2 - (x[k] - m1[k]) / r1);
+            }
+            float r = lags[b] - pred;
+            // Huber weighting: quadratic near zero, linear in the tails
+            float hw = w[b];
+            float ar = fabsf(r);
+            if (ar > huberLags) hw *= huberLags / ar;
+            cost += hw * r * r;
+            if (JtJ) {
+                for (int i = 0; i < 3; i++) {
+                    Jtr[i] += hw * J[i] * r;
+                    for (int j = 0; j < 3; j++) JtJ[i][j] += hw * J[i] * J[j];
+                }
+            }
+        }
+        return cost;
+    }
+    // keep parameters in their valid range; sources are above the array plane
+    // ------------------------------------------------------------------------
+    void constrain(float *x)
+    {
+        if (mode == TDOA_DIRECTION) {
+            if (x[1] < 0.) { x[1] = -x[1]; }
+            if (x[1] > M_PI / 2.) { x[1] = M_PI - x[1]; x[0] += M_PI; }
+            x[0] = atan2f(sinf(x[0]), cosf(x[0]));
+        } else {
+            if (x[2] < 0.) x[2] = -x[2];
+        }
+    }
+    // solve the (small, symmetric) n x n system A s = r with Gaussian elimination
+    // ------------------------------------------------------------------------
+    static bool solveNormal(float A[3][3], const float r[3], float s[3], int n)
+    {
+        float M[3][4];
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) M[i][j] = A[i][j];
+            M[i][n] = r[i];
+        }
+        for (int c = 0; c < n; c++) {
+            int p = c;
+            for (int i = c + 1; i < n; i++) if (fabsf(M[i][c]) > fabsf(M[p][c])) p = i;
+            if (fabsf(M[p][c]) < 1e-12f) return false;
+            if (p != c) for (int j = 0; j <= n; j++) { float t = M[c][j]; M[c][j] = M[p][j]; M[p][j] = t; }
+            for (int i = c + 1; i < n; i++) {
+                float f = M[i][c] / M[c][c];
+                for (int j = c; j <= n; j++) M[i][j] -= f * M[c][j];
+            }
+        }
+        for (int i = n - 1; i >= 0; i--) {
+            float v = M[i][n];
+            for (int j = i + 1; j < n; j++) v -= M[i][j] * s[j];
+            s[i] = v / M[i][i];
+        }
+        for (int i = n; i < 3; i++) s[i] = 0.;
+        return true;
+    }
+};
+
+#endif
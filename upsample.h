@@ -0,0 +1,152 @@
+#ifndef UPSAMPLE_H
+#define UPSAMPLE_H
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Band-limited oversampling of the lag rows. One lag is 1 / 46875 s, about
+// 7 mm of path difference; linear interpolation between lags (what the lag
+// texture does) flattens and shifts peaks, a windowed sinc does not.
+//
+// Each row of NUMLAGS lags becomes NUMLAGS * factor samples. Sample u sits at
+// lag bin (u + 0.5) / factor - 0.5 of the original row, so the upsampled row
+// covers the same texture coordinates as the original: the shader's lookup
+// at (bin + 0.5) / NUMLAGS needs no change, only the texture gets wider.
+//
+// Between two lags b0 and b0 + 1 lie 'factor' samples, each a 16-tap
+// Blackman-windowed sinc over lags b0 - 7 .. b0 + 8 (one kernel per phase,
+// normalised to unit gain). The kernel is kept tap-major, so the samples of
+// one gap are four contiguous outputs per SSE2 multiply-add. Rows are edge
+// extended beyond bins 5 .. NUMLAGS - 1, since bins 0-4 carry nothing.
+
+#ifndef NUMLAGS
+#define NUMLAGS 256
+#endif
+
+class LagUpsampler
+{
+public:
+    static const int TAPS = 16;
+    static const int MAXFACTOR = 8;
+
+    int factor;
+
+    LagUpsampler(int f = 1) : factor(0)
+    {
+        setFactor(f);
+    }
+    // 1 (off), 2, 4 or MAXFACTOR; other factors round down to one of these.
+    // Odd factors would put the samples half a sample off the grid bin()
+    // describes
+    // ------------------------------------------------------------------------
+    void setFactor(int f)
+    {
+        if (f > MAXFACTOR) f = MAXFACTOR;
+        int p = 1;
+        while (2 * p <= f) p *= 2;
+        f = p;
+        if (f == factor) return;
+        factor = f;
+        kernel.assign((size_t)TAPS * factor, 0.f);
+        for (int q = 0; q < factor; q++) {
+            float frac = (q + 0.5f) / factor;
+            double sum = 0.;
+            for (int t = 0; t < TAPS; t++) {
+                double x = (t - (TAPS / 2 - 1)) - frac;
+                double s = fabs(x) < 1e-9 ? 1. : sin(M_PI * x) / (M_PI * x);
+                double w = 0.42 + 0.5 * cos(M_PI * x / (TAPS / 2)) + 0.08 * cos(2. * M_PI * x / (TAPS / 2));
+                kernel[(size_t)t * factor + q] = s * w;
+                sum += s * w;
+            }
+            for (int t = 0; t < TAPS; t++) kernel[(size_t)t * factor + q] /= sum;
+        }
+        line.assign((size_t)(NUMLAGS + 1) * factor, 0.f);
+    }
+    // samples per upsampled row
+    // ------------------------------------------------------------------------
+    int length() const
+    {
+        return NUMLAGS * factor;
+    }
+    // lag bin of the original row that upsampled sample u (may be
+    // fractional) sits at
+    // ------------------------------------------------------------------------
+    float bin(float u) const
+    {
+        return (u + 0.5f) / factor - 0.5f;
+    }
+    // upsampled sample nearest to (fractional) lag bin lagBin, the inverse
+    // of bin()
+    // ------------------------------------------------------------------------
+    int sample(float lagBin) const
+    {
+        return (int)floorf((lagBin + 0.5f) * factor);
+    }
+    // first upsampled sample past bins 0-4
+    // ------------------------------------------------------------------------
+    int firstSample() const
+    {
+        return 5 * factor;
+    }
+    // upsample rows[0 .. baselines - 1] into out, length() floats per row
+    // ------------------------------------------------------------------------
+    void process(const float (*rows)[NUMLAGS], int baselines, float *out)
+    {
+        for (int b = 0; b < baselines; b++) {
+            float *dst = out + (size_t)b * length();
+            if (factor == 1) {
+                memcpy(dst, rows[b], NUMLAGS * sizeof(float));
+                continue;
+            }
+            const float *row = rows[b];
+            for (int i = 0; i < NUMLAGS + TAPS; i++) {
+                int j = i - TAPS / 2;
+                pad[i] = row[j < 5 ? 5 : (j > NUMLAGS - 1 ? NUMLAGS - 1 : j)];
+            }
+            // gap b0 (between lags b0 and b0 + 1) for b0 = -1 .. NUMLAGS - 1
+            // fills line[(b0 + 1) * factor ...]
+            for (int g = 0; g <= NUMLAGS; g++) {
+                const float *x = pad + g;     // lag b0 - 7 = g - 8
+                float *y = &line[(size_t)g * factor];
+                int q = 0;
+#if defined(__SSE2__)
+                for (; q + 4 <= factor; q += 4) {
+                    __m128 acc = _mm_setzero_ps();
+                    for (int t = 0; t < TAPS; t++) {
+                        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(x[t]), _mm_loadu_ps(&kernel[(size_t)t * factor + q])));
+                    }
+                    _mm_storeu_ps(y + q, acc);
+                }
+#endif
+                for (; q < factor; q++) {
+                    float acc = 0.f;
+                    for (int t = 0; t < TAPS; t++) acc += x[t] * kernel[(size_t)t * factor + q];
+                    y[q] = acc;
+                }
+            }
+            // gap -1 starts half a lag before sample 0
+            memcpy(dst, &line[factor / 2], length() * sizeof(float));
+            for (int u = 0; u < firstSample(); u++) dst[u] = 0.f;
+        }
+    }
+    // highest sample of an upsampled row past bins 0-4
+    // ------------------------------------------------------------------------
+    int peak(const float *row) const
+    {
+        int best = firstSample();
+        for (int u = best + 1; u < length(); u++) if (row[u] > row[best]) best = u;
+        return best;
+    }
+
+private:
+    std::vector<float> kernel;      // [tap][phase]
+    std::vector<float> line;        // one row, from half a lag before bin 0
+    float pad[NUMLAGS + TAPS];      // one row, edge extended by TAPS / 2
+};
+
+#endif